@@ -0,0 +1,228 @@
+/*
+ * Tiled-Image-Viewer example application for libheif.
+ *
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * Tiled-Image-Viewer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Tiled-Image-Viewer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cache_policy.h"
+
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+
+
+// --- LRU: a single list, most recently used tile at the front
+
+class LRUPolicy : public CachePolicy
+{
+public:
+  const char* name() const override { return "lru"; }
+
+  void insert(uint64_t id) override { move_to_front(id); }
+
+  void access(uint64_t id, bool /*new_reference*/) override
+  {
+    if (positions.count(id)) {
+      move_to_front(id);
+    }
+  }
+
+  bool select_victim(const std::function<bool(uint64_t)>& is_candidate, uint64_t& victim) const override
+  {
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      if (is_candidate(*it)) {
+        victim = *it;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void evict(uint64_t id) override { remove(id); }
+
+  void remove(uint64_t id) override
+  {
+    auto it = positions.find(id);
+    if (it != positions.end()) {
+      order.erase(it->second);
+      positions.erase(it);
+    }
+  }
+
+private:
+  std::list<uint64_t> order;
+  std::unordered_map<uint64_t, std::list<uint64_t>::iterator> positions;
+
+  void move_to_front(uint64_t id)
+  {
+    remove(id);
+    order.push_front(id);
+    positions[id] = order.begin();
+  }
+};
+
+
+// --- ARC (Megiddo and Modha, 2003). Tiles used once are kept in T1, tiles that came into view repeatedly in T2.
+//     The ghost lists B1 and B2 remember the ids of tiles recently evicted from T1 and T2. A new use of a ghost
+//     shifts the target size 'p' of T1 towards the list that would have kept the tile. A long pan only
+//     streams tiles through T1 and does not flush the working set in T2.
+
+class ARCPolicy : public CachePolicy
+{
+public:
+  explicit ARCPolicy(size_t capacity) : capacity(std::max((size_t) 1, capacity)) {}
+
+  const char* name() const override { return "arc"; }
+
+  void insert(uint64_t id) override
+  {
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+      move_to(id, T1);
+
+      // --- limit the ghost lists to the size of the cache
+
+      while (lists[T1].size() + lists[B1].size() > capacity && !lists[B1].empty()) {
+        drop_lru(B1);
+      }
+
+      while (lists[T1].size() + lists[T2].size() + lists[B1].size() + lists[B2].size() > 2 * capacity && !lists[B2].empty()) {
+        drop_lru(B2);
+      }
+
+      return;
+    }
+
+    double b1 = (double) lists[B1].size();
+    double b2 = (double) lists[B2].size();
+
+    switch (it->second.list) {
+      case T1:
+      case T2:
+        move_to(id, T2);
+        break;
+      case B1:
+        p = std::min((double) capacity, p + std::max(1.0, b2 / b1));
+        move_to(id, T2);
+        break;
+      case B2:
+        p = std::max(0.0, p - std::max(1.0, b1 / b2));
+        move_to(id, T2);
+        break;
+    }
+  }
+
+  void access(uint64_t id, bool new_reference) override
+  {
+    auto it = entries.find(id);
+    if (it == entries.end() || it->second.list == B1 || it->second.list == B2) {
+      return;
+    }
+
+    move_to(id, new_reference ? T2 : it->second.list);
+  }
+
+  bool select_victim(const std::function<bool(uint64_t)>& is_candidate, uint64_t& victim) const override
+  {
+    list_id first = (!lists[T1].empty() && (double) lists[T1].size() > p) ? T1 : T2;
+    list_id second = (first == T1) ? T2 : T1;
+
+    for (list_id list : {first, second}) {
+      for (auto it = lists[list].rbegin(); it != lists[list].rend(); ++it) {
+        if (is_candidate(*it)) {
+          victim = *it;
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  void evict(uint64_t id) override
+  {
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+      return;
+    }
+
+    if (it->second.list == T1) {
+      move_to(id, B1);
+    }
+    else if (it->second.list == T2) {
+      move_to(id, B2);
+    }
+  }
+
+  void remove(uint64_t id) override
+  {
+    auto it = entries.find(id);
+    if (it != entries.end()) {
+      lists[it->second.list].erase(it->second.position);
+      entries.erase(it);
+    }
+  }
+
+private:
+  enum list_id
+  {
+    T1, T2, B1, B2
+  };
+
+  struct Entry
+  {
+    list_id list;
+    std::list<uint64_t>::iterator position;
+  };
+
+  size_t capacity;
+  double p = 0; // target size of T1
+
+  std::list<uint64_t> lists[4]; // most recently used tile at the front
+  std::unordered_map<uint64_t, Entry> entries;
+
+  void move_to(uint64_t id, list_id list)
+  {
+    auto it = entries.find(id);
+    if (it != entries.end()) {
+      lists[it->second.list].erase(it->second.position);
+    }
+
+    lists[list].push_front(id);
+    entries[id] = {list, lists[list].begin()};
+  }
+
+  void drop_lru(list_id list)
+  {
+    entries.erase(lists[list].back());
+    lists[list].pop_back();
+  }
+};
+
+
+std::unique_ptr<CachePolicy> create_cache_policy(const std::string& name, size_t capacity)
+{
+  if (name == "lru") {
+    return std::make_unique<LRUPolicy>();
+  }
+  else if (name == "arc") {
+    return std::make_unique<ARCPolicy>(capacity);
+  }
+  else {
+    return nullptr;
+  }
+}
@@ -0,0 +1,64 @@
+/*
+ * Tiled-Image-Viewer example application for libheif.
+ *
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * Tiled-Image-Viewer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Tiled-Image-Viewer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILED_IMAGE_VIEWER_CACHE_POLICY_H
+#define TILED_IMAGE_VIEWER_CACHE_POLICY_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+
+// Replacement policy of the tile cache. The policy only decides which tile to evict. The tiles themselves
+// are stored by the viewer, which informs the policy about each use of a tile, identified by a unique id.
+
+class CachePolicy
+{
+public:
+  virtual ~CachePolicy() = default;
+
+  virtual const char* name() const = 0;
+
+  // The tile is used for the first time, or again after it has been evicted.
+  virtual void insert(uint64_t id) = 0;
+
+  // A tile in the cache is used. 'new_reference' is true if the tile came into view again, false if it
+  // is still visible since the last frame.
+  virtual void access(uint64_t id, bool new_reference) = 0;
+
+  // Selects the tile to evict next among the tiles for which 'is_candidate' returns true.
+  // Returns false if the policy knows none of the candidates.
+  virtual bool select_victim(const std::function<bool(uint64_t)>& is_candidate, uint64_t& victim) const = 0;
+
+  // The tile was evicted from the cache.
+  virtual void evict(uint64_t id) = 0;
+
+  // The tile was removed from the cache without being evicted, e.g. because its decoding was cancelled. Unknown ids are ignored.
+  virtual void remove(uint64_t id) = 0;
+};
+
+
+// Supported policies:
+//  "lru" - least recently used
+//  "arc" - adaptive replacement cache, which is resistant to scans of tiles that are used only once
+// Returns nullptr if the name is unknown. 'capacity' is the number of tiles in the cache.
+std::unique_ptr<CachePolicy> create_cache_policy(const std::string& name, size_t capacity);
+
+#endif
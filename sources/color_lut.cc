@@ -0,0 +1,289 @@
+/*
+ * Tiled-Image-Viewer example application for libheif.
+ *
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * Tiled-Image-Viewer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Tiled-Image-Viewer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "color_lut.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+
+#if HAVE_LCMS2
+#include <lcms2.h>
+#endif
+
+
+using Matrix = std::array<std::array<double, 3>, 3>;
+using Vector = std::array<double, 3>;
+
+static Matrix multiply(const Matrix& a, const Matrix& b)
+{
+  Matrix m{};
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      for (int k = 0; k < 3; k++) {
+        m[i][j] += a[i][k] * b[k][j];
+      }
+    }
+  }
+
+  return m;
+}
+
+static Vector multiply(const Matrix& a, const Vector& v)
+{
+  Vector r{};
+  for (int i = 0; i < 3; i++) {
+    r[i] = a[i][0] * v[0] + a[i][1] * v[1] + a[i][2] * v[2];
+  }
+
+  return r;
+}
+
+static Matrix inverse(const Matrix& m)
+{
+  double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+               m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+               m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+  Matrix r;
+  r[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) / det;
+  r[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) / det;
+  r[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) / det;
+  r[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) / det;
+  r[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) / det;
+  r[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) / det;
+  r[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) / det;
+  r[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) / det;
+  r[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) / det;
+  return r;
+}
+
+static Vector xy_to_XYZ(double x, double y)
+{
+  return {x / y, 1, (1 - x - y) / y};
+}
+
+// RGB to XYZ matrix of the primaries and white point (x,y chromaticities: red, green, blue, white)
+static Matrix rgb_to_xyz(const double xy[8])
+{
+  Matrix primaries;
+  for (int c = 0; c < 3; c++) {
+    Vector p = xy_to_XYZ(xy[2 * c], xy[2 * c + 1]);
+    for (int i = 0; i < 3; i++) {
+      primaries[i][c] = p[i];
+    }
+  }
+
+  Vector scale = multiply(inverse(primaries), xy_to_XYZ(xy[6], xy[7]));
+
+  for (int i = 0; i < 3; i++) {
+    for (int c = 0; c < 3; c++) {
+      primaries[i][c] *= scale[c];
+    }
+  }
+
+  return primaries;
+}
+
+// Bradford chromatic adaptation between two white points
+static Matrix adapt_white(double src_x, double src_y, double dst_x, double dst_y)
+{
+  const Matrix bradford{{{0.8951, 0.2664, -0.1614},
+                         {-0.7502, 1.7135, 0.0367},
+                         {0.0389, -0.0685, 1.0296}}};
+
+  Vector src = multiply(bradford, xy_to_XYZ(src_x, src_y));
+  Vector dst = multiply(bradford, xy_to_XYZ(dst_x, dst_y));
+
+  Matrix scale{};
+  for (int i = 0; i < 3; i++) {
+    scale[i][i] = dst[i] / src[i];
+  }
+
+  return multiply(inverse(bradford), multiply(scale, bradford));
+}
+
+static double srgb_to_linear(double v)
+{
+  return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+}
+
+static double linear_to_srgb(double v)
+{
+  return v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1 / 2.4) - 0.055;
+}
+
+static const double srgb_xy[8] = {0.64, 0.33, 0.30, 0.60, 0.15, 0.06, 0.3127, 0.3290};
+
+// Fills the LUT with 'convert', which maps the RGB values of a grid point (0..1) to sRGB
+template <class Convert>
+static std::vector<uint8_t> fill_color_lut(Convert convert)
+{
+  const int n = color_lut_size;
+  std::vector<uint8_t> lut((size_t) n * n * n * 4);
+
+  for (int b = 0; b < n; b++) {
+    for (int g = 0; g < n; g++) {
+      for (int r = 0; r < n; r++) {
+        Vector rgb = convert(Vector{(double) r / (n - 1), (double) g / (n - 1), (double) b / (n - 1)});
+
+        uint8_t* p = &lut[((size_t) g * n * n + (size_t) b * n + r) * 4];
+        for (int c = 0; c < 3; c++) {
+          p[c] = (uint8_t) std::lround(std::clamp(rgb[c], 0.0, 1.0) * 255);
+        }
+        p[3] = 255;
+      }
+    }
+  }
+
+  return lut;
+}
+
+static std::vector<uint8_t> create_nclx_lut(const heif_color_profile_nclx& nclx)
+{
+  // --- transfer function of the decoded values. The video transfer functions are shown like sRGB, as most viewers do.
+
+  double gamma;
+  switch (nclx.transfer_characteristics) {
+    case heif_transfer_characteristic_ITU_R_BT_709_5:
+    case heif_transfer_characteristic_unspecified:
+    case heif_transfer_characteristic_ITU_R_BT_601_6:
+    case heif_transfer_characteristic_IEC_61966_2_1:
+    case heif_transfer_characteristic_ITU_R_BT_2020_2_10bit:
+    case heif_transfer_characteristic_ITU_R_BT_2020_2_12bit:
+      gamma = 0; // sRGB curve
+      break;
+    case heif_transfer_characteristic_linear:
+      gamma = 1;
+      break;
+    case heif_transfer_characteristic_ITU_R_BT_470_6_System_M:
+      gamma = 2.2;
+      break;
+    case heif_transfer_characteristic_ITU_R_BT_470_6_System_B_G:
+      gamma = 2.8;
+      break;
+    default:
+      printf("transfer characteristics %d not supported, colors are not converted\n", (int) nclx.transfer_characteristics);
+      return {};
+  }
+
+  // --- conversion of the primaries into sRGB primaries
+
+  double xy[8] = {nclx.color_primary_red_x, nclx.color_primary_red_y,
+                  nclx.color_primary_green_x, nclx.color_primary_green_y,
+                  nclx.color_primary_blue_x, nclx.color_primary_blue_y,
+                  nclx.color_primary_white_x, nclx.color_primary_white_y};
+
+  Matrix to_srgb = multiply(inverse(rgb_to_xyz(srgb_xy)),
+                            multiply(adapt_white(xy[6], xy[7], srgb_xy[6], srgb_xy[7]), rgb_to_xyz(xy)));
+
+  bool identity = (gamma == 0);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      identity = identity && std::abs(to_srgb[i][j] - (i == j ? 1 : 0)) < 1e-3;
+    }
+  }
+
+  if (identity) {
+    return {};
+  }
+
+  return fill_color_lut([&](Vector rgb) {
+    for (double& v : rgb) {
+      v = (gamma == 0) ? srgb_to_linear(v) : std::pow(v, gamma);
+    }
+
+    rgb = multiply(to_srgb, rgb);
+
+    for (double& v : rgb) {
+      v = linear_to_srgb(std::clamp(v, 0.0, 1.0));
+    }
+
+    return rgb;
+  });
+}
+
+#if HAVE_LCMS2
+static std::vector<uint8_t> create_icc_lut(const std::vector<uint8_t>& icc)
+{
+  cmsHPROFILE input = cmsOpenProfileFromMem(icc.data(), (cmsUInt32Number) icc.size());
+  if (!input) {
+    printf("cannot read the ICC profile, colors are not converted\n");
+    return {};
+  }
+
+  std::vector<uint8_t> lut;
+
+  if (cmsGetColorSpace(input) == cmsSigRgbData) {
+    cmsHPROFILE output = cmsCreate_sRGBProfile();
+    cmsHTRANSFORM transform = cmsCreateTransform(input, TYPE_RGB_16, output, TYPE_RGB_16, INTENT_PERCEPTUAL, 0);
+
+    if (transform) {
+      lut = fill_color_lut([&](Vector rgb) {
+        cmsUInt16Number in[3], out[3];
+        for (int c = 0; c < 3; c++) {
+          in[c] = (cmsUInt16Number) std::lround(rgb[c] * 65535);
+        }
+
+        cmsDoTransform(transform, in, out, 1);
+
+        return Vector{out[0] / 65535.0, out[1] / 65535.0, out[2] / 65535.0};
+      });
+
+      cmsDeleteTransform(transform);
+    }
+
+    cmsCloseProfile(output);
+  }
+
+  cmsCloseProfile(input);
+
+  return lut;
+}
+#endif
+
+std::vector<uint8_t> create_color_lut(const heif_image_handle* handle)
+{
+  heif_color_profile_type type = heif_image_handle_get_color_profile_type(handle);
+
+  if (type == heif_color_profile_type_rICC || type == heif_color_profile_type_prof) {
+#if HAVE_LCMS2
+    std::vector<uint8_t> icc(heif_image_handle_get_raw_color_profile_size(handle));
+    heif_error err = heif_image_handle_get_raw_color_profile(handle, icc.data());
+    if (err.code == heif_error_Ok) {
+      return create_icc_lut(icc);
+    }
+#else
+    printf("ICC profiles need lcms2, colors are not converted\n");
+#endif
+    return {};
+  }
+
+  heif_color_profile_nclx* nclx = nullptr;
+  heif_error err = heif_image_handle_get_nclx_color_profile(handle, &nclx);
+  if (err.code != heif_error_Ok || !nclx) {
+    return {};
+  }
+
+  std::vector<uint8_t> lut = create_nclx_lut(*nclx);
+  heif_nclx_color_profile_free(nclx);
+
+  return lut;
+}
@@ -0,0 +1,38 @@
+/*
+ * Tiled-Image-Viewer example application for libheif.
+ *
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * Tiled-Image-Viewer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Tiled-Image-Viewer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILED_IMAGE_VIEWER_COLOR_LUT_H
+#define TILED_IMAGE_VIEWER_COLOR_LUT_H
+
+#include <libheif/heif.h>
+
+#include <cstdint>
+#include <vector>
+
+
+// Number of grid points of the 3D LUT along each axis
+const int color_lut_size = 33;
+
+// Computes a 3D LUT that converts the decoded RGB values of the image into sRGB, from its ICC profile (if built with
+// lcms2) or its nclx color information. The LUT is laid out as a 2D RGBA image of color_lut_size^2 x color_lut_size
+// pixels: one slice per blue value side by side, red increasing to the right and green downwards within each slice.
+// Returns an empty vector if the image is sRGB already or its color profile is not supported.
+std::vector<uint8_t> create_color_lut(const heif_image_handle* handle);
+
+#endif
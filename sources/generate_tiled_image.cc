@@ -0,0 +1,450 @@
+/*
+ * Tiled-Image-Viewer example application for libheif.
+ *
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * Tiled-Image-Viewer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Tiled-Image-Viewer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Writes synthetic tiled HEIF images with procedural content, so that the viewer
+ * can be benchmarked and tested without downloading the large example images.
+ * The content of every pixel only depends on its position in the full resolution
+ * image. Hence, the output is fully reproducible and all pyramid layers show the
+ * same content.
+ */
+
+#include <libheif/heif.h>
+#include <libheif/heif_experimental.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+
+enum class layout
+{
+  tili,
+  grid,
+  unci
+};
+
+enum class pattern
+{
+  gradient,
+  mandelbrot
+};
+
+uint32_t image_width = 8192;
+uint32_t image_height = 8192;
+uint32_t tile_width = 512;
+uint32_t tile_height = 512;
+int num_layers = 1;
+int quality = 75;
+bool lossless = false;
+
+layout output_layout = layout::tili;
+heif_compression_format codec = heif_compression_AV1;
+heif_metadata_compression unci_compression = heif_metadata_compression_brotli;
+pattern content = pattern::gradient;
+
+
+// --- procedural content
+
+// Computes the color at position (x,y) in full resolution image coordinates.
+void pattern_color(double x, double y, uint8_t* rgb)
+{
+  if (content == pattern::mandelbrot) {
+    // Fit the Mandelbrot set into the image while keeping the aspect ratio.
+
+    double scale = std::max(3.0 / image_width, 3.0 / image_height);
+    double cr = (x - image_width * 0.5) * scale - 0.6;
+    double ci = (y - image_height * 0.5) * scale;
+
+    const int max_iterations = 256;
+    double zr = 0, zi = 0;
+    int i;
+    for (i = 0; i < max_iterations && zr * zr + zi * zi < 4.0; i++) {
+      double t = zr * zr - zi * zi + cr;
+      zi = 2 * zr * zi + ci;
+      zr = t;
+    }
+
+    if (i == max_iterations) {
+      rgb[0] = rgb[1] = rgb[2] = 0;
+    }
+    else {
+      double v = i / (double) max_iterations;
+      rgb[0] = (uint8_t) (255 * std::sqrt(v));
+      rgb[1] = (uint8_t) (255 * v);
+      rgb[2] = (uint8_t) (128 + 127 * std::sin(i * 0.2));
+    }
+  }
+  else {
+    // Smooth color gradient over the whole image with concentric rings
+    // and a grid of lines every 256 pixels for checking positions.
+
+    // clamped, because the padding of the edge tiles lies outside of the image
+    double fx = std::min(1.0, x / image_width);
+    double fy = std::min(1.0, y / image_height);
+    double r = std::hypot(x - image_width * 0.5, y - image_height * 0.5);
+
+    rgb[0] = (uint8_t) (255 * fx);
+    rgb[1] = (uint8_t) (255 * fy);
+    rgb[2] = (uint8_t) (128 + 127 * std::cos(r * 0.01));
+
+    if (((uint32_t) x) % 256 < 2 || ((uint32_t) y) % 256 < 2) {
+      rgb[0] = rgb[1] = rgb[2] = 255;
+    }
+  }
+}
+
+
+// Renders the tile (tx,ty) of a pyramid layer that is downscaled by 'scale' relative to the full resolution image.
+heif_image* create_tile_image(uint32_t tx, uint32_t ty, uint32_t scale)
+{
+  heif_image* img;
+  heif_error err = heif_image_create((int) tile_width, (int) tile_height, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  if (err.code) {
+    fprintf(stderr, "Cannot create image: %s\n", err.message);
+    exit(10);
+  }
+
+  err = heif_image_add_plane(img, heif_channel_interleaved, (int) tile_width, (int) tile_height, 8);
+  if (err.code) {
+    fprintf(stderr, "Cannot add image plane: %s\n", err.message);
+    exit(10);
+  }
+
+  int stride;
+  uint8_t* data = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+
+  for (uint32_t y = 0; y < tile_height; y++) {
+    for (uint32_t x = 0; x < tile_width; x++) {
+      // sample at the center of the area covered by this pixel in the full resolution image
+      double px = ((tx * tile_width + x) + 0.5) * scale;
+      double py = ((ty * tile_height + y) + 0.5) * scale;
+
+      pattern_color(px, py, data + y * stride + x * 3);
+    }
+  }
+
+  return img;
+}
+
+
+// --- image encoding
+
+heif_image_handle* encode_layer(heif_context* ctx, heif_encoder* encoder, uint32_t scale)
+{
+  uint32_t layer_width = (image_width + scale - 1) / scale;
+  uint32_t layer_height = (image_height + scale - 1) / scale;
+  uint32_t columns = (layer_width + tile_width - 1) / tile_width;
+  uint32_t rows = (layer_height + tile_height - 1) / tile_height;
+
+  printf("layer %u x %u  (%u x %u tiles)\n", layer_width, layer_height, columns, rows);
+
+  heif_image_handle* handle = nullptr;
+  heif_error err{};
+
+  switch (output_layout) {
+    case layout::tili: {
+      heif_tiled_image_parameters params{};
+      params.version = 1;
+      params.image_width = layer_width;
+      params.image_height = layer_height;
+      params.tile_width = tile_width;
+      params.tile_height = tile_height;
+      params.offset_field_length = 40;
+      params.size_field_length = 32;
+      params.number_of_extra_dimensions = 0;
+      params.tiles_are_sequential = 1;
+
+      err = heif_context_add_tiled_image(ctx, &params, nullptr, encoder, &handle);
+      break;
+    }
+
+    case layout::grid:
+      err = heif_context_add_grid_image(ctx, layer_width, layer_height, columns, rows, nullptr, &handle);
+      break;
+
+    case layout::unci: {
+      heif_unci_image_parameters params{};
+      params.version = 1;
+      params.image_width = layer_width;
+      params.image_height = layer_height;
+      params.tile_width = tile_width;
+      params.tile_height = tile_height;
+      params.compression = unci_compression;
+
+      heif_image* prototype = create_tile_image(0, 0, scale);
+      err = heif_context_add_unci_image(ctx, &params, nullptr, prototype, &handle);
+      heif_image_release(prototype);
+      break;
+    }
+  }
+
+  if (err.code) {
+    fprintf(stderr, "Cannot add tiled image: %s\n", err.message);
+    exit(10);
+  }
+
+  for (uint32_t ty = 0; ty < rows; ty++) {
+    for (uint32_t tx = 0; tx < columns; tx++) {
+      heif_image* tile = create_tile_image(tx, ty, scale);
+
+      err = heif_context_add_image_tile(ctx, handle, tx, ty, tile, encoder);
+      heif_image_release(tile);
+
+      if (err.code) {
+        fprintf(stderr, "Cannot encode tile %u;%u: %s\n", tx, ty, err.message);
+        exit(10);
+      }
+    }
+
+    printf("\r  %u/%u rows", ty + 1, rows);
+    fflush(stdout);
+  }
+
+  printf("\n");
+
+  return handle;
+}
+
+
+// --- command line
+
+static struct option long_options[] = {
+    {(char* const) "width",            required_argument, 0, 'W'},
+    {(char* const) "height",           required_argument, 0, 'H'},
+    {(char* const) "tile-size",        required_argument, 0, 's'},
+    {(char* const) "layout",           required_argument, 0, 'l'},
+    {(char* const) "codec",            required_argument, 0, 'c'},
+    {(char* const) "unci-compression", required_argument, 0, 'u'},
+    {(char* const) "pyramid-layers",   required_argument, 0, 'p'},
+    {(char* const) "pattern",          required_argument, 0, 'P'},
+    {(char* const) "quality",          required_argument, 0, 'q'},
+    {(char* const) "lossless",         no_argument,       0, 'L'},
+    {(char* const) "help",             no_argument,       0, 'h'},
+    {0, 0,                                                0, 0}
+};
+
+void show_help(const char* argv0)
+{
+  fprintf(stderr, " generate-tiled-image    (c) Dirk Farin\n");
+  fprintf(stderr, "----------------------------------------\n");
+  fprintf(stderr, "usage: generate_tiled_image [options] output.heif\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -W, --width N                 image width (default: 8192)\n");
+  fprintf(stderr, "  -H, --height N                image height (default: 8192)\n");
+  fprintf(stderr, "  -s, --tile-size N | WxH       tile size (default: 512)\n");
+  fprintf(stderr, "  -l, --layout tili|grid|unci   image item type (default: tili)\n");
+  fprintf(stderr, "  -c, --codec av1|hevc|jpeg|j2k tile codec for 'tili' and 'grid' (default: av1)\n");
+  fprintf(stderr, "  -u, --unci-compression brotli|deflate|off   'unci' compression (default: brotli)\n");
+  fprintf(stderr, "  -p, --pyramid-layers N        number of 'pymd' resolution layers (default: 1)\n");
+  fprintf(stderr, "  -P, --pattern gradient|mandelbrot   image content (default: gradient)\n");
+  fprintf(stderr, "  -q, --quality N               lossy quality 0-100 (default: 75)\n");
+  fprintf(stderr, "  -L, --lossless                lossless compression\n");
+  fprintf(stderr, "  -h, --help                    show help\n");
+}
+
+
+int main(int argc, char** argv)
+{
+  while (true) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "W:H:s:l:c:u:p:P:q:Lh", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'W':
+        image_width = (uint32_t) atoi(optarg);
+        break;
+      case 'H':
+        image_height = (uint32_t) atoi(optarg);
+        break;
+      case 's':
+        if (sscanf(optarg, "%ux%u", &tile_width, &tile_height) != 2) {
+          tile_width = tile_height = (uint32_t) atoi(optarg);
+        }
+        break;
+      case 'l':
+        if (strcmp(optarg, "tili") == 0) {
+          output_layout = layout::tili;
+        }
+        else if (strcmp(optarg, "grid") == 0) {
+          output_layout = layout::grid;
+        }
+        else if (strcmp(optarg, "unci") == 0) {
+          output_layout = layout::unci;
+        }
+        else {
+          fprintf(stderr, "Unknown layout: %s\n", optarg);
+          return 5;
+        }
+        break;
+      case 'c':
+        if (strcmp(optarg, "av1") == 0) {
+          codec = heif_compression_AV1;
+        }
+        else if (strcmp(optarg, "hevc") == 0) {
+          codec = heif_compression_HEVC;
+        }
+        else if (strcmp(optarg, "jpeg") == 0) {
+          codec = heif_compression_JPEG;
+        }
+        else if (strcmp(optarg, "j2k") == 0) {
+          codec = heif_compression_JPEG2000;
+        }
+        else {
+          fprintf(stderr, "Unknown codec: %s\n", optarg);
+          return 5;
+        }
+        break;
+      case 'u':
+        if (strcmp(optarg, "brotli") == 0) {
+          unci_compression = heif_metadata_compression_brotli;
+        }
+        else if (strcmp(optarg, "deflate") == 0) {
+          unci_compression = heif_metadata_compression_deflate;
+        }
+        else if (strcmp(optarg, "off") == 0) {
+          unci_compression = heif_metadata_compression_off;
+        }
+        else {
+          fprintf(stderr, "Unknown 'unci' compression: %s\n", optarg);
+          return 5;
+        }
+        break;
+      case 'p':
+        num_layers = atoi(optarg);
+        break;
+      case 'P':
+        if (strcmp(optarg, "gradient") == 0) {
+          content = pattern::gradient;
+        }
+        else if (strcmp(optarg, "mandelbrot") == 0) {
+          content = pattern::mandelbrot;
+        }
+        else {
+          fprintf(stderr, "Unknown pattern: %s\n", optarg);
+          return 5;
+        }
+        break;
+      case 'q':
+        quality = atoi(optarg);
+        break;
+      case 'L':
+        lossless = true;
+        break;
+      case 'h':
+        show_help(argv[0]);
+        return 0;
+    }
+  }
+
+  if (optind != argc - 1) {
+    show_help(argv[0]);
+    return 0;
+  }
+
+  if (image_width == 0 || image_height == 0 || tile_width == 0 || tile_height == 0 || num_layers < 1) {
+    fprintf(stderr, "Invalid image size, tile size, or number of layers.\n");
+    return 5;
+  }
+
+  const char* output_filename = argv[optind];
+
+  heif_context* ctx = heif_context_alloc();
+
+  // --- get encoder for the tile codec ('unci' does not use an encoder plugin)
+
+  heif_encoder* encoder = nullptr;
+
+  if (output_layout != layout::unci) {
+    heif_error err = heif_context_get_encoder_for_format(ctx, codec, &encoder);
+    if (err.code) {
+      fprintf(stderr, "Cannot get encoder: %s\n", err.message);
+      exit(10);
+    }
+
+    if (lossless) {
+      heif_encoder_set_lossless(encoder, true);
+    }
+    else {
+      heif_encoder_set_lossy_quality(encoder, quality);
+    }
+  }
+
+  // --- encode all layers, from the full resolution image down to the smallest layer
+
+  std::vector<heif_item_id> layer_ids;
+  heif_image_handle* primary_handle = nullptr;
+
+  for (int layer = 0; layer < num_layers; layer++) {
+    uint32_t scale = 1U << layer;
+    if (image_width / scale == 0 || image_height / scale == 0) {
+      printf("image too small for %d layers, stopping at %d layers\n", num_layers, layer);
+      break;
+    }
+
+    heif_image_handle* handle = encode_layer(ctx, encoder, scale);
+
+    layer_ids.insert(layer_ids.begin(), heif_image_handle_get_item_id(handle));
+
+    if (layer == 0) {
+      primary_handle = handle;
+    }
+    else {
+      heif_image_handle_release(handle);
+    }
+  }
+
+  heif_context_set_primary_image(ctx, primary_handle);
+  heif_image_handle_release(primary_handle);
+
+  // --- 'pymd' pyramid group, ordered from the smallest to the full resolution layer
+
+  if (layer_ids.size() > 1) {
+    heif_item_id group_id;
+    heif_error err = heif_context_add_pyramid_entity_group(ctx, layer_ids.data(), layer_ids.size(), &group_id);
+    if (err.code) {
+      fprintf(stderr, "Cannot add pyramid group: %s\n", err.message);
+      exit(10);
+    }
+  }
+
+  if (encoder) {
+    heif_encoder_release(encoder);
+  }
+
+  printf("writing %s ...\n", output_filename);
+
+  heif_error err = heif_context_write_to_file(ctx, output_filename);
+  if (err.code) {
+    fprintf(stderr, "Cannot write file: %s\n", err.message);
+    exit(10);
+  }
+
+  heif_context_free(ctx);
+
+  return 0;
+}
@@ -18,16 +18,42 @@
  */
 
 #include <libheif/heif.h>
+#include <libheif/heif_items.h>
+#include <libheif/heif_properties.h>
 #include <raylib.h>
+#include <rlgl.h>
 
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "cache_policy.h"
+#include "color_lut.h"
+
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
 #include <thread>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <cstring>
+#include <cstdint>
+#include <cinttypes>
 #include <cassert>
+#include <new>
+#include <chrono>
+#include <random>
 #include <getopt.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 
 int window_width = 2000;
@@ -36,6 +62,225 @@ int window_height = 2000;
 int tile_cache_size = 150;
 
 bool process_transformations = true;
+bool gpu_orientation = false; // decode tiles without rotation and mirroring and apply them when drawing
+bool color_management = true; // convert the colors of images with ICC profile or nclx color information into sRGB when drawing
+
+bool reuse_decode_state = true; // reuse the decoding options and pixel buffers across tiles
+
+int num_decode_threads = (int) std::max(1U, std::thread::hardware_concurrency());
+int libheif_decoding_threads = 0; // threads that libheif may use within the decoding of one tile. 0 = libheif's default
+
+std::string decoder_id; // libheif decoder plugin, e.g. "dav1d". Empty = libheif's default.
+
+int max_open_files = 64;
+
+std::string cache_policy_name = "lru";
+
+float pan_speed = 1500;          // keyboard panning, in screen pixels per second
+float kinetic_friction = 4;      // decay rate of the kinetic scrolling velocity, per second
+float prefetch_lookahead = 0.5f; // seconds of movement for which tiles are prefetched
+
+uint32_t render_tile_size = 512; // smaller file tiles are combined into render tiles of about this size. 0 = off.
+
+int max_texture_size = 1024;            // larger tiles are split into several textures
+uint32_t slice_threshold = 4096;        // images without tiling that are larger than this are sliced into tiles. 0 = off.
+int num_upload_buffers = 0;             // size of the ring of pixel buffer objects for asynchronous texture uploads. 0 = off.
+size_t cpu_pixel_budget = 32 * 1024 * 1024; // decoded pixels of tiles that are kept after the upload. 0 = off.
+int upload_budget = 4 * 1024 * 1024;    // pixels uploaded to the GPU per frame. 0 = unlimited.
+
+
+// --- Input files. A single image is a mosaic with only one file at position (0,0).
+//
+// Files are opened lazily when they first become visible. Their metadata (layers and tilings) is kept
+// after that, but the heif_context is closed again when too many files are open.
+
+struct HeatmapCell
+{
+  uint32_t accesses = 0; // number of times the tile came into view
+  uint32_t decodes = 0;
+  float last_decode_ms = 0;
+  uint64_t last_visible_frame = 0;
+};
+
+// Rotation and mirroring of an image, as a transposition followed by mirroring. This covers all combinations of 'irot' and 'imir'.
+struct Orientation
+{
+  bool transpose = false; // x and y swapped, applied first
+  bool flip_x = false;    // mirrored left-right
+  bool flip_y = false;    // mirrored top-bottom
+
+  bool is_identity() const { return !transpose && !flip_x && !flip_y; }
+
+  // Appends a rotation by 90 degrees counter-clockwise
+  void rotate_ccw()
+  {
+    bool previous_flip_x = flip_x;
+    transpose = !transpose;
+    flip_x = flip_y;
+    flip_y = !previous_flip_x;
+  }
+
+  Orientation inverse() const
+  {
+    return transpose ? Orientation{true, flip_y, flip_x} : *this;
+  }
+
+  // Maps the point 'p' of an image of size w x h into the oriented image
+  Vector2 apply(Vector2 p, float w, float h) const
+  {
+    if (transpose) {
+      std::swap(p.x, p.y);
+      std::swap(w, h);
+    }
+
+    if (flip_x) {
+      p.x = w - p.x;
+    }
+
+    if (flip_y) {
+      p.y = h - p.y;
+    }
+
+    return p;
+  }
+};
+
+struct Histogram
+{
+  uint64_t counts[3][256] = {}; // red, green, blue
+  uint64_t pixels = 0;
+};
+
+struct Layer
+{
+  heif_image_handle* handle = nullptr; // only valid while the file is open
+  heif_image_tiling file_tiling;       // the tiles as stored in the file
+  heif_image_tiling tiling;            // render tiles: one or more file tiles that are shown as one texture
+  Orientation orientation;             // applied when drawing. Only used with 'gpu_orientation', the tilings are untransformed then.
+  uint32_t item_type; // 'grid', 'tili', 'unci', ...
+
+  std::vector<HeatmapCell> heatmap; // one cell per tile, allocated on first use. Locked by 'tilemutex'.
+  uint32_t heatmap_max_accesses = 1;
+  float heatmap_max_decode_ms = 1;
+
+  Histogram histogram;               // of the decoded tiles, each counted once. Locked by 'tilemutex'.
+  std::vector<bool> histogram_tiles; // tiles that have been counted, allocated on first use. Locked by 'tilemutex'.
+  uint32_t histogram_tiles_counted = 0;
+
+  HeatmapCell& heatmap_cell(int tx, int ty)
+  {
+    if (heatmap.empty()) {
+      heatmap.resize((size_t) tiling.num_columns * tiling.num_rows);
+    }
+
+    return heatmap[(size_t) ty * tiling.num_columns + tx];
+  }
+};
+
+struct FileReader;
+struct ScratchImage;
+
+struct HeifFile
+{
+  std::string filename;
+  int offset_x = 0, offset_y = 0; // position on the mosaic canvas, in full resolution pixels
+  uint32_t width = 0, height = 0; // full resolution size. 0 if not known before the file was opened.
+  uint32_t view = 0;              // the side on which the file is shown in comparison mode
+
+  // --- metadata, cached when the file is opened for the first time
+
+  bool has_metadata = false;
+  std::vector<Layer> layers; // 'pymd' layers, starting with the smallest one
+  uint32_t primary_layer = 0;
+  ScratchImage* scratch = nullptr; // for large images without tiling, which are sliced into tiles
+  std::vector<uint8_t> color_lut;  // 3D LUT into sRGB, see create_color_lut(). Empty if no conversion is needed.
+
+  // --- open state, locked by 'filemutex'
+
+  heif_context* ctx = nullptr;
+  FileReader* reader = nullptr;
+  bool opening = false;
+  int in_use = 0;          // number of decoding threads currently using the context
+  uint64_t last_used = 0;  // for LRU closing of contexts
+  bool open_requested = false;
+
+  bool minimap_requested = false; // render thread only
+  bool minimap_tiles = false;     // the tiles of the coarsest layer are shown in the minimap. Render thread only.
+  bool histogram_complete = false; // all tiles of the coarsest layer are counted, or it is too large. Render thread only.
+  Texture2D color_lut_texture{};  // render thread only, loaded when the file is drawn for the first time
+};
+
+std::vector<HeifFile> files;
+std::mutex filemutex;   // this locks the open state of all files and the publishing of their metadata
+std::condition_variable file_opened_cond;
+uint64_t file_use_counter = 0;
+int num_open_files = 0;
+
+struct ContextPoolStats
+{
+  int opens = 0;
+  int closes = 0;
+  double total_open_ms = 0;
+  double max_open_ms = 0;
+  int max_open = 0;
+} context_pool_stats;
+
+// --- Views. Normally, there is one view covering the whole window. In comparison mode, the window is split
+//     into two views that show different files with the same pan and zoom.
+
+struct View
+{
+  int x, width; // horizontal area in the window
+
+  // --- decoding times of the tiles shown in this view, locked by 'tilemutex'
+
+  int tiles_decoded = 0;
+  double total_decode_ms = 0;
+  double last_decode_ms = 0;
+};
+
+std::vector<View> views;
+
+
+// --- Heatmap overlay for tuning tile sizes
+
+enum class heatmap_mode
+{
+  off,
+  accesses,
+  decode_latency
+};
+
+heatmap_mode heatmap = heatmap_mode::off;
+
+
+// All files are aligned at their full resolution layer. The zoom is the number of halvings of the full resolution.
+uint32_t zoom_shift = 0;
+uint32_t max_zoom_shift = 0;
+
+
+// Returns the layer of the file that is shown at the zoom level, or -1 if the file's pyramid does not reach down that far.
+int file_layer(const HeifFile& file, uint32_t shift)
+{
+  return (int) file.layers.size() - 1 - (int) shift;
+}
+
+int floor_div(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+
+// --- Tile cache, shared by all files
+
+struct TileKey
+{
+  uint32_t file;
+  uint32_t layer; // layer in the file's pyramid
+  int x, y;
+
+  bool operator==(const TileKey& k) const { return file == k.file && layer == k.layer && x == k.x && y == k.y; }
+};
 
 enum class tile_state
 {
@@ -44,96 +289,3725 @@ enum class tile_state
   ready
 };
 
-struct Tile
+// Priority classes of the cache. When the cache is full, speculative tiles are evicted first,
+// then recently visible tiles, and visible tiles only as a last resort. Pinned tiles are never evicted.
+enum class cache_class
 {
-  int x, y;
-  uint32_t layer;
-  tile_state state = tile_state::loading;
+  pinned,      // e.g. the tiles of the minimap
+  visible,     // drawn in the current frame
+  recent,      // drawn before, but not visible anymore
+  speculative  // prefetched, but never drawn yet
+};
+
+const int num_cache_classes = 4;
+const char* cache_class_names[num_cache_classes] = {"pinned", "visible", "recent", "speculative"};
+
+// Tiles larger than 'max_texture_size' are split into several parts with one texture each.
+// The parts are uploaded to the GPU over several frames, so that a large tile does not stall the rendering.
+struct TilePart
+{
+  int x, y;        // position in the tile
+  Image image;     // decoded pixels, nullptr if released. Kept after the upload for tiles in the CPU tier.
+  int upload_buffer = -1; // the pixel buffer object holding the pixels, or -1
   Texture2D texture;
-  Image image;
+  bool uploaded = false;
+};
+
+struct Tile
+{
+  TileKey key;
+  tile_state state = tile_state::loading; // 'waiting_for_texture_upload' until all parts are uploaded
+  cache_class cls = cache_class::visible;
+  uint64_t last_used_frame = 0;
+  std::vector<TilePart> parts;
+  bool cpu_pixels = false;       // the pixels of the uploaded parts are kept in the CPU tier
+  bool pixels_requested = false; // decoding the pixels for the CPU tier again has been requested
+  bool histogram_pin = false;    // only pinned until the tile is counted into the histogram of its layer
 };
 
 std::vector<Tile> tiles;
 std::mutex tilemutex;   // this locks all operations on the 'tiles' vector
 
-int tile_width, tile_height; // Tile size in signed integer (for computing with negative coordinates)
+uint64_t frame_nr = 0;
+
+int frame_upload_pixels = 0; // pixels uploaded to the GPU in the current frame
+
+int visible_tiles_pending = 0; // visible tiles (or unopened files) that could not be shown in the current frame
 
-heif_context* ctx;
+uint64_t cache_evictions[num_cache_classes]{}; // number of evicted tiles per class, locked by 'tilemutex'
 
-std::vector<heif_image_handle*> pymd_layer_handles;
-uint32_t active_layer;
+// Replacement policy of each view. It orders the tiles that have been visible. Speculative tiles are unknown to the
+// policy until they are drawn for the first time. Pinned tiles are never known to it. Locked by 'tilemutex'.
+std::vector<std::unique_ptr<CachePolicy>> cache_policies;
 
-heif_image_tiling tiling;
+// Tiles that came into view and whether they were found in the cache (decoded or still decoding). Locked by 'tilemutex'.
+uint64_t cache_lookups = 0;
+uint64_t cache_hits = 0;
 
-void move_tile_to_front_of_lru_cache(size_t idx)
+// Unique id of a tile for the replacement policy: 20 bits file, 6 bits layer, 19 bits each for the tile column and row
+uint64_t tile_id(const TileKey& key)
 {
-  Tile t = tiles[idx];
-  for (size_t i = idx; i > 0; i--) {
-    tiles[i] = tiles[i - 1];
+  return ((uint64_t) key.file << 44) | ((uint64_t) key.layer << 38) | ((uint64_t) key.x << 19) | (uint64_t) key.y;
+}
+
+
+// Visible tiles that have not been drawn in the current frame count as recently visible.
+cache_class get_cache_class(const Tile& tile)
+{
+  if (tile.cls == cache_class::visible && tile.last_used_frame < frame_nr) {
+    return cache_class::recent;
   }
 
-  tiles[0] = t;
+  return tile.cls;
 }
 
+// Marks the tile as visible in the current frame. 'tilemutex' must be held.
+void touch_tile(Tile& tile)
+{
+  if (tile.cls != cache_class::pinned) {
+    CachePolicy& policy = *cache_policies[files[tile.key.file].view];
+
+    if (tile.cls == cache_class::speculative) {
+      policy.insert(tile_id(tile.key));
+    }
+    else {
+      policy.access(tile_id(tile.key), tile.last_used_frame + 1 < frame_nr);
+    }
+
+    tile.cls = cache_class::visible;
+  }
 
-std::mutex loadmutex;
+  tile.last_used_frame = frame_nr;
+}
 
-void load_tile(int tx, int ty, int layer)
+// Pinned tiles are not managed by the replacement policy. 'tilemutex' must be held.
+void pin_tile(Tile& tile)
 {
-  printf("loading Tile %d;%d, layer: %d\n", tx, ty, layer);
+  if (tile.cls == cache_class::visible) {
+    cache_policies[files[tile.key.file].view]->evict(tile_id(tile.key));
+  }
 
-  std::lock_guard<std::mutex> lock(loadmutex);
+  tile.cls = cache_class::pinned;
+  tile.histogram_pin = false;
+}
 
-  heif_image* img;
+// Unpins a tile that was only pinned for counting its histogram. It is handled like a prefetched tile
+// until it is drawn again. 'tilemutex' must be held.
+void release_histogram_pin(Tile& tile)
+{
+  if (tile.histogram_pin) {
+    tile.cls = cache_class::speculative;
+    tile.histogram_pin = false;
+  }
+}
 
-  heif_decoding_options* options = heif_decoding_options_alloc();
-  options->ignore_transformations = !process_transformations;
+// 'tilemutex' must be held
+Tile* find_tile(const TileKey& key)
+{
+  for (auto& tile : tiles) {
+    if (tile.key == key) {
+      return &tile;
+    }
+  }
+
+  return nullptr;
+}
+
+// Removes a tile that is still waiting for decoding from the cache. 'tilemutex' must be held.
+void remove_loading_tile(const TileKey& key)
+{
+  for (size_t i = 0; i < tiles.size(); i++) {
+    if (tiles[i].key == key && tiles[i].state == tile_state::loading) {
+      cache_policies[files[key.file].view]->remove(tile_id(key));
+      tiles.erase(tiles.begin() + (long) i);
+      return;
+    }
+  }
+}
+
+
+// --- File reader that counts the bytes read by each thread. Used for the decoding profile.
+
+thread_local uint64_t bytes_read_by_thread = 0;
 
-  heif_error err = heif_image_handle_decode_image_tile(pymd_layer_handles[layer], &img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, options, tx, ty);
-  heif_decoding_options_free(options);
+struct FileReader
+{
+  FILE* fp;
+  int64_t size;
+};
+
+int64_t reader_get_position(void* userdata)
+{
+  return ftello(((FileReader*) userdata)->fp);
+}
+
+int reader_read(void* data, size_t size, void* userdata)
+{
+  bytes_read_by_thread += size;
+  return fread(data, 1, size, ((FileReader*) userdata)->fp) == size ? 0 : 1;
+}
+
+int reader_seek(int64_t position, void* userdata)
+{
+  return fseeko(((FileReader*) userdata)->fp, position, SEEK_SET);
+}
+
+heif_reader_grow_status reader_wait_for_file_size(int64_t target_size, void* userdata)
+{
+  return target_size > ((FileReader*) userdata)->size ? heif_reader_grow_status_size_beyond_eof : heif_reader_grow_status_size_reached;
+}
+
+const heif_reader counting_reader = {
+    .reader_api_version = 1,
+    .get_position = reader_get_position,
+    .read = reader_read,
+    .seek = reader_seek,
+    .wait_for_file_size = reader_wait_for_file_size
+};
+
+
+// Small file tiles are combined into larger render tiles. This reduces the number of textures, draw calls and cache entries.
+// Returns the tiling of the render tiles.
+heif_image_tiling get_render_tiling(const heif_image_tiling& file_tiling)
+{
+  uint32_t merge_x = std::min(file_tiling.num_columns, std::max(1U, render_tile_size / file_tiling.tile_width));
+  uint32_t merge_y = std::min(file_tiling.num_rows, std::max(1U, render_tile_size / file_tiling.tile_height));
+
+  heif_image_tiling tiling = file_tiling;
+  tiling.tile_width *= merge_x;
+  tiling.tile_height *= merge_y;
+  tiling.num_columns = (file_tiling.num_columns + merge_x - 1) / merge_x;
+  tiling.num_rows = (file_tiling.num_rows + merge_y - 1) / merge_y;
+
+  return tiling;
+}
+
+
+
+// --- Large images without tiling. Decoding the whole image for each view and showing it as one texture is not feasible.
+//     Instead, the image is decoded once, sliced into tiles that are stored in a memory-mapped scratch file,
+//     and a pyramid is computed from it. The tiles are then shown like those of a tiled image with 'pymd' pyramid.
+
+const uint32_t scratch_tile_size = 512;
+
+struct ScratchImage
+{
+  std::mutex mutex;              // held while decoding
+  bool decoded = false;
+  FILE* fp = nullptr;            // temporary file, deleted when closed
+  uint8_t* data = nullptr;       // the memory-mapped file
+  size_t size = 0;
+  std::vector<size_t> layer_offsets; // the tiles of each layer in raster order, each with scratch_tile_size^2 RGBA pixels
+};
+
+bool needs_slicing(const heif_image_tiling& tiling)
+{
+  return slice_threshold > 0 && tiling.num_columns == 1 && tiling.num_rows == 1 &&
+         std::max(tiling.image_width, tiling.image_height) > slice_threshold;
+}
+
+// Returns the pyramid layers of the sliced image, starting with the smallest one
+std::vector<Layer> get_scratch_layers(const Layer& image_layer)
+{
+  std::vector<Layer> layers;
+
+  uint32_t w = image_layer.file_tiling.image_width;
+  uint32_t h = image_layer.file_tiling.image_height;
+
+  for (;;) {
+    Layer layer;
+    layer.item_type = image_layer.item_type;
+    layer.orientation = image_layer.orientation;
+
+    heif_image_tiling& tiling = layer.file_tiling;
+    tiling = image_layer.file_tiling;
+    tiling.tile_width = tiling.tile_height = scratch_tile_size;
+    tiling.num_columns = (w + scratch_tile_size - 1) / scratch_tile_size;
+    tiling.num_rows = (h + scratch_tile_size - 1) / scratch_tile_size;
+    tiling.image_width = w;
+    tiling.image_height = h;
+
+    layer.tiling = get_render_tiling(tiling);
+    layers.insert(layers.begin(), layer);
+
+    if (w <= scratch_tile_size && h <= scratch_tile_size) {
+      break;
+    }
+
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+
+  return layers;
+}
+
+uint8_t* scratch_tile(const HeifFile& file, uint32_t layer, uint32_t tx, uint32_t ty)
+{
+  const heif_image_tiling& tiling = file.layers[layer].file_tiling;
+  size_t tile_bytes = (size_t) scratch_tile_size * scratch_tile_size * 4;
+
+  return file.scratch->data + file.scratch->layer_offsets[layer] + ((size_t) ty * tiling.num_columns + tx) * tile_bytes;
+}
+
+// Computes the tiles of a layer by averaging 2x2 pixels of the next larger layer
+void downsample_scratch_layer(const HeifFile& file, uint32_t layer)
+{
+  const heif_image_tiling& src = file.layers[layer + 1].file_tiling;
+  const heif_image_tiling& dst = file.layers[layer].file_tiling;
+  const uint32_t T = scratch_tile_size;
+
+  auto src_pixel = [&](uint32_t x, uint32_t y) {
+    x = std::min(x, src.image_width - 1);
+    y = std::min(y, src.image_height - 1);
+    return scratch_tile(file, layer + 1, x / T, y / T) + ((y % T) * T + x % T) * 4;
+  };
+
+  for (uint32_t ty = 0; ty < dst.num_rows; ty++) {
+    for (uint32_t tx = 0; tx < dst.num_columns; tx++) {
+      uint8_t* out = scratch_tile(file, layer, tx, ty);
+
+      uint32_t w = std::min(T, dst.image_width - tx * T);
+      uint32_t h = std::min(T, dst.image_height - ty * T);
+
+      for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+          uint32_t sx = 2 * (tx * T + x);
+          uint32_t sy = 2 * (ty * T + y);
+          const uint8_t* p00 = src_pixel(sx, sy);
+          const uint8_t* p01 = src_pixel(sx + 1, sy);
+          const uint8_t* p10 = src_pixel(sx, sy + 1);
+          const uint8_t* p11 = src_pixel(sx + 1, sy + 1);
+
+          for (int c = 0; c < 4; c++) {
+            out[(y * T + x) * 4 + c] = (uint8_t) ((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Decodes the image into the scratch file and computes its pyramid, if this has not been done yet.
+// The file must be acquired. Other threads that need tiles of the image wait until it is finished.
+void decode_scratch_image(HeifFile& file, const heif_decoding_options* options)
+{
+  ScratchImage& scratch = *file.scratch;
+  std::lock_guard<std::mutex> lock(scratch.mutex);
+
+  if (scratch.decoded) {
+    return;
+  }
+
+  printf("decoding untiled image %s into scratch file ...\n", file.filename.c_str());
+
+  // --- create the memory-mapped scratch file. Tiles at the image border are padded with zeros.
+
+  size_t tile_bytes = (size_t) scratch_tile_size * scratch_tile_size * 4;
+  for (const auto& layer : file.layers) {
+    scratch.layer_offsets.push_back(scratch.size);
+    scratch.size += (size_t) layer.file_tiling.num_columns * layer.file_tiling.num_rows * tile_bytes;
+  }
+
+  scratch.fp = tmpfile();
+  if (!scratch.fp || ftruncate(fileno(scratch.fp), (off_t) scratch.size) != 0) {
+    fprintf(stderr, "Cannot create scratch file of %zu MB\n", scratch.size >> 20);
+    exit(10);
+  }
+
+  void* data = mmap(nullptr, scratch.size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(scratch.fp), 0);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Cannot map scratch file\n");
+    exit(10);
+  }
+  scratch.data = (uint8_t*) data;
+
+  // --- decode the full image and slice it into tiles
 
+  uint32_t full_layer = (uint32_t) file.layers.size() - 1;
+  const heif_image_tiling& tiling = file.layers[full_layer].file_tiling;
+
+  heif_image* img;
+  heif_error err = heif_decode_image(file.layers[full_layer].handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, options);
   if (err.code) {
     printf("heif_decode_image error: %s\n", err.message);
     exit(0);
   }
 
   int stride;
-  const uint8_t* data = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+  const uint8_t* pixels = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+  uint32_t width = std::min((uint32_t) heif_image_get_width(img, heif_channel_interleaved), tiling.image_width);
+  uint32_t height = std::min((uint32_t) heif_image_get_height(img, heif_channel_interleaved), tiling.image_height);
+
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t tx = 0; tx < tiling.num_columns; tx++) {
+      uint32_t x0 = tx * scratch_tile_size;
+      uint32_t w = std::min(scratch_tile_size, width - x0);
+      uint8_t* tile = scratch_tile(file, full_layer, tx, y / scratch_tile_size);
+      memcpy(tile + (y % scratch_tile_size) * scratch_tile_size * 4, pixels + (size_t) y * stride + x0 * 4, w * 4);
+    }
+  }
+
+  heif_image_release(img);
+
+  // --- compute the pyramid
+
+  for (int layer = (int) full_layer - 1; layer >= 0; layer--) {
+    downsample_scratch_layer(file, (uint32_t) layer);
+  }
+
+  scratch.decoded = true;
+}
+
+void free_scratch_image(ScratchImage* scratch)
+{
+  if (scratch->data) {
+    munmap(scratch->data, scratch->size);
+  }
+  if (scratch->fp) {
+    fclose(scratch->fp);
+  }
+
+  delete scratch;
+}
+
+
+// Transformations that libheif applies while decoding. With 'gpu_orientation', rotation and mirroring are applied when drawing instead.
+bool decode_with_transformations()
+{
+  return process_transformations && !gpu_orientation;
+}
+
+// Collects the rotations and mirrorings of the image item in the order in which they are applied
+Orientation get_orientation(heif_context* ctx, heif_item_id id)
+{
+  Orientation orientation;
+
+  heif_property_id transforms[16];
+  int num_transforms = heif_item_get_transformation_properties(ctx, id, transforms, 16);
+
+  for (int i = 0; i < num_transforms; i++) {
+    switch (heif_item_get_property_type(ctx, id, transforms[i])) {
+      case heif_item_property_type_transform_rotation:
+        for (int angle = heif_item_get_property_transform_rotation_ccw(ctx, id, transforms[i]); angle > 0; angle -= 90) {
+          orientation.rotate_ccw();
+        }
+        break;
+      case heif_item_property_type_transform_mirror:
+        if (heif_item_get_property_transform_mirror(ctx, id, transforms[i]) == heif_transform_mirror_direction_vertical) {
+          orientation.flip_y = !orientation.flip_y;
+        }
+        else {
+          orientation.flip_x = !orientation.flip_x;
+        }
+        break;
+      default:
+        break; // cropping is not supported
+    }
+  }
+
+  return orientation;
+}
+
+// Opens the file and gets the handles of all pyramid layers. Called without 'filemutex' held.
+// The metadata is only written into 'file' if it is not known yet.
+heif_context* read_file(HeifFile& file, std::vector<heif_image_handle*>& handles, FileReader*& reader)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  // --- remove security limit to be able to load extremely large 'grid' images
+
+  const heif_security_limits* no_limits = heif_get_disabled_security_limits();
+  heif_context_set_security_limits(ctx, no_limits);
+
+  if (libheif_decoding_threads > 0) {
+    heif_context_set_max_decoding_threads(ctx, libheif_decoding_threads);
+  }
+
+  // --- load and parse input file
+
+  printf("loading %s ...\n", file.filename.c_str());
+
+  FILE* fp = fopen(file.filename.c_str(), "rb");
+  if (!fp) {
+    fprintf(stderr, "Cannot open file: %s\n", file.filename.c_str());
+    exit(10);
+  }
 
-  Color* pixels = (Color*) malloc(tile_width * tile_height * sizeof(Color));
+  fseeko(fp, 0, SEEK_END);
+  reader = new FileReader{fp, ftello(fp)};
+  fseeko(fp, 0, SEEK_SET);
 
-  // Fill the image with RGB pixels
-  for (int y = 0; y < tile_height; y++) {
-    memcpy(&pixels[y * tile_width], data + y * stride, tile_width * 4);
+  heif_error err = heif_context_read_from_reader(ctx, &counting_reader, reader, nullptr);
+  if (err.code) {
+    fprintf(stderr, "Cannot load file: %s\n", err.message);
+    exit(10);
+  }
+
+  // --- get the ID of the primary image
+
+  heif_item_id  primary_id;
+  err = heif_context_get_primary_image_ID(ctx, &primary_id);
+  if (err.code) {
+    fprintf(stderr, "Cannot get primary image: %s\n", err.message);
+    exit(10);
+  }
+
+
+  // --- Load multi-resolution pyramid if there is one.
+
+  uint32_t primary_layer = 0;
+
+  int nGroups;
+  struct heif_entity_group* groups = heif_context_get_entity_groups(ctx, heif_fourcc('p', 'y', 'm', 'd'), primary_id, &nGroups);
+  if (nGroups > 0) {
+    assert(nGroups == 1);
+    handles.resize(groups[0].num_entities);
+
+    for (uint32_t i = 0; i < groups[0].num_entities; i++) {
+      uint32_t layer_image_id = groups[0].entities[i];
+      heif_context_get_image_handle(ctx, layer_image_id, &handles[i]);
+      if (layer_image_id == primary_id) {
+        primary_layer = i;
+      }
+    }
+  }
+  else {
+    // Build dummy pyramid of only one image
+
+    handles.resize(1);
+    heif_context_get_image_handle(ctx, primary_id, &handles[0]);
+  }
+  heif_entity_groups_release(groups, nGroups);
+
+
+  // --- Get tiling information for all layers
+
+  if (!file.has_metadata) {
+    std::vector<uint8_t> color_lut;
+    if (color_management) {
+      color_lut = create_color_lut(handles[primary_layer]);
+      if (!color_lut.empty()) {
+        printf("colors are converted into sRGB\n");
+      }
+    }
+
+    std::vector<Layer> layers(handles.size());
+    for (size_t i = 0; i < handles.size(); i++) {
+      heif_image_handle_get_image_tiling(handles[i], decode_with_transformations(), &layers[i].file_tiling);
+      layers[i].tiling = get_render_tiling(layers[i].file_tiling);
+      if (gpu_orientation && process_transformations) {
+        layers[i].orientation = get_orientation(ctx, heif_image_handle_get_item_id(handles[i]));
+      }
+      layers[i].item_type = heif_item_get_item_type(ctx, heif_image_handle_get_item_id(handles[i]));
+    }
+
+    ScratchImage* scratch = nullptr;
+    if (handles.size() == 1 && needs_slicing(layers[0].file_tiling)) {
+      printf("image without tiling, will be sliced into tiles\n");
+
+      layers = get_scratch_layers(layers[0]);
+      primary_layer = (uint32_t) layers.size() - 1;
+      scratch = new ScratchImage;
+    }
+
+    const heif_image_tiling& tiling = layers[primary_layer].file_tiling;
+    printf("tilesize: %u x %u\n", tiling.tile_width, tiling.tile_height);
+    printf("tiles: %u x %u\n", tiling.num_columns, tiling.num_rows);
+
+    const heif_image_tiling& render_tiling = layers[primary_layer].tiling;
+    if (render_tiling.tile_width != tiling.tile_width || render_tiling.tile_height != tiling.tile_height) {
+      printf("render tile size: %u x %u\n", render_tiling.tile_width, render_tiling.tile_height);
+    }
+
+    std::lock_guard<std::mutex> lock(filemutex);
+    file.layers = layers;
+    file.primary_layer = primary_layer;
+    file.scratch = scratch;
+    file.color_lut = std::move(color_lut);
+    file.width = layers.back().tiling.image_width;
+    file.height = layers.back().tiling.image_height;
+    if (layers.back().orientation.transpose) {
+      std::swap(file.width, file.height);
+    }
+    file.has_metadata = true;
+  }
+
+  // --- The image handle of a sliced image belongs to its full resolution layer. The other layers have no handle.
+
+  if (file.scratch) {
+    handles.resize(file.layers.size(), nullptr);
+    std::swap(handles[0], handles.back());
+  }
+
+  return ctx;
+}
+
+
+// 'filemutex' must be held
+void close_file(HeifFile& file)
+{
+  for (auto& layer : file.layers) {
+    if (layer.handle) {
+      heif_image_handle_release(layer.handle);
+      layer.handle = nullptr;
+    }
+  }
+
+  heif_context_free(file.ctx);
+  file.ctx = nullptr;
+
+  fclose(file.reader->fp);
+  delete file.reader;
+  file.reader = nullptr;
+
+  num_open_files--;
+  context_pool_stats.closes++;
+}
+
+
+// Closes the least recently used files that are not in use until at most 'max_open_files' are open. 'filemutex' must be held.
+void close_unused_files()
+{
+  while (num_open_files > max_open_files) {
+    HeifFile* lru_file = nullptr;
+    for (auto& file : files) {
+      if (file.ctx && file.in_use == 0 && (!lru_file || file.last_used < lru_file->last_used)) {
+        lru_file = &file;
+      }
+    }
+
+    if (!lru_file) {
+      return; // all open files are in use, close them later
+    }
+
+    close_file(*lru_file);
+  }
+}
+
+
+// Opens the file if it is not open yet and protects it from being closed until release_file() is called.
+HeifFile& acquire_file(uint32_t file_idx)
+{
+  HeifFile& file = files[file_idx];
+
+  std::unique_lock<std::mutex> lock(filemutex);
+
+  file_opened_cond.wait(lock, [&file] { return !file.opening; });
+
+  file.in_use++;
+  file.last_used = ++file_use_counter;
+
+  if (file.ctx) {
+    return file;
+  }
+
+  file.opening = true;
+  lock.unlock();
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<heif_image_handle*> handles;
+  FileReader* reader;
+  heif_context* ctx = read_file(file, handles, reader);
+
+  double open_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  lock.lock();
+
+  file.ctx = ctx;
+  file.reader = reader;
+  for (size_t i = 0; i < handles.size(); i++) {
+    file.layers[i].handle = handles[i];
+  }
+  file.opening = false;
+
+  num_open_files++;
+  context_pool_stats.opens++;
+  context_pool_stats.total_open_ms += open_ms;
+  context_pool_stats.max_open_ms = std::max(context_pool_stats.max_open_ms, open_ms);
+  context_pool_stats.max_open = std::max(context_pool_stats.max_open, num_open_files);
+
+  close_unused_files();
+
+  lock.unlock();
+  file_opened_cond.notify_all();
+
+  return file;
+}
+
+
+void release_file(HeifFile& file)
+{
+  std::lock_guard<std::mutex> lock(filemutex);
+  file.in_use--;
+  close_unused_files();
+}
+
+
+// Reads a mosaic description. Each line contains a filename and the position of the image on the canvas:
+//   <filename> <x> <y> [<width> <height>]
+// When the full resolution size of the image is given, the file is not opened before it becomes visible.
+// Empty lines and lines starting with '#' are ignored. Relative filenames are relative to the mosaic file.
+void read_mosaic(const char* mosaic_filename)
+{
+  std::ifstream istr(mosaic_filename);
+  if (!istr) {
+    fprintf(stderr, "Cannot open mosaic file: %s\n", mosaic_filename);
+    exit(10);
+  }
+
+  std::string dir = mosaic_filename;
+  size_t slash = dir.find_last_of('/');
+  dir = (slash == std::string::npos) ? "" : dir.substr(0, slash + 1);
+
+  std::string line;
+  int line_nr = 0;
+  while (std::getline(istr, line)) {
+    line_nr++;
+
+    std::istringstream line_str(line);
+    HeifFile file;
+    if (!(line_str >> file.filename) || file.filename[0] == '#') {
+      continue;
+    }
+
+    if (!(line_str >> file.offset_x >> file.offset_y)) {
+      fprintf(stderr, "%s:%d: expected '<filename> <x> <y> [<width> <height>]'\n", mosaic_filename, line_nr);
+      exit(5);
+    }
+
+    if (!(line_str >> file.width >> file.height)) {
+      file.width = file.height = 0;
+    }
+
+    if (file.filename[0] != '/') {
+      file.filename = dir + file.filename;
+    }
+
+    files.push_back(file);
+  }
+
+  if (files.empty()) {
+    fprintf(stderr, "No images in mosaic file: %s\n", mosaic_filename);
+    exit(5);
+  }
+}
+
+
+// --- Decoding
+
+// Heap allocations per thread. By default, only the pixel buffers and decoding options allocated by the viewer are counted.
+// Building with COUNT_ALLOCATIONS replaces the global operator new to also count the C++ allocations made within libheif,
+// but not the ones made with malloc() within the codec libraries.
+
+thread_local uint64_t allocations_by_thread = 0;
+
+#if COUNT_ALLOCATIONS
+void* operator new(size_t size)
+{
+  allocations_by_thread++;
+
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+#endif
+
+
+// Decoding statistics per pyramid layer and image type, locked by 'tilemutex'
+
+struct DecodeProfile
+{
+  std::vector<float> decode_ms;
+  uint64_t bytes_read = 0;
+  uint64_t pixels = 0;
+  uint64_t allocations = 0;
+};
+
+std::map<std::pair<uint32_t, uint32_t>, DecodeProfile> decode_profiles; // key: (layer, item type)
+
+
+std::string fourcc_to_string(uint32_t fourcc)
+{
+  std::string s(4, ' ');
+  for (int i = 0; i < 4; i++) {
+    s[i] = (char) ((fourcc >> (24 - 8 * i)) & 0xFF);
+  }
+  return s;
+}
+
+// 'tilemutex' must be held
+void print_decode_profile()
+{
+  printf("decoding profile:\n");
+  printf("layer  type  tiles   mean ms    p95 ms   MB read    MPix/s  allocs/tile\n");
+
+  for (const auto& [key, profile] : decode_profiles) {
+    std::vector<float> ms = profile.decode_ms;
+    std::sort(ms.begin(), ms.end());
+
+    double total_ms = 0;
+    for (float t : ms) {
+      total_ms += t;
+    }
+
+    size_t p95_idx = std::min(ms.size() - 1, (size_t) (ms.size() * 0.95));
+
+    printf("%5u  %s %6zu %9.2f %9.2f %9.2f %9.2f %12.1f\n", key.first, fourcc_to_string(key.second).c_str(), ms.size(),
+           total_ms / (double) ms.size(), ms[p95_idx], (double) profile.bytes_read / 1e6,
+           total_ms > 0 ? (double) profile.pixels / 1e3 / total_ms : 0.0,
+           (double) profile.allocations / (double) ms.size());
+  }
+}
+
+
+// --- Pixel buffers of decoded tiles. The tiles of a layer all have the same size, so the buffers are kept for
+//     the next decoded tile after their texture has been uploaded.
+
+std::mutex pixel_buffer_mutex;
+std::map<size_t, std::vector<void*>> free_pixel_buffers; // key: size in bytes
+size_t num_free_pixel_buffers = 0;
+const size_t max_free_pixel_buffers = 64;
+
+void* allocate_pixel_buffer(size_t size)
+{
+  if (reuse_decode_state) {
+    std::lock_guard<std::mutex> lock(pixel_buffer_mutex);
+
+    auto& buffers = free_pixel_buffers[size];
+    if (!buffers.empty()) {
+      void* buffer = buffers.back();
+      buffers.pop_back();
+      num_free_pixel_buffers--;
+      return buffer;
+    }
+  }
+
+  allocations_by_thread++;
+  return malloc(size);
+}
+
+// Returns the pixel buffer of the image to the pool, or frees it if the pool is full
+void release_pixel_buffer(Image& image)
+{
+  if (reuse_decode_state) {
+    std::lock_guard<std::mutex> lock(pixel_buffer_mutex);
+
+    if (num_free_pixel_buffers < max_free_pixel_buffers) {
+      free_pixel_buffers[(size_t) image.width * image.height * sizeof(Color)].push_back(image.data);
+      num_free_pixel_buffers++;
+      image.data = nullptr;
+      return;
+    }
+  }
+
+  UnloadImage(image);
+  image.data = nullptr;
+}
+
+// --- Asynchronous texture upload through a ring of OpenGL pixel buffer objects. The render thread maps the free buffers
+//     at the start of each frame. The decoding threads copy the decoded pixels into a mapped buffer, and the render thread
+//     only starts the transfer into the texture, which the driver can run in parallel to the rendering.
+
+struct UploadBuffer
+{
+  enum class state
+  {
+    unmapped,  // waiting to be mapped by the render thread
+    available, // mapped, can be filled by a decoding thread
+    filled     // contains the pixels of a tile part that waits for its upload
+  };
+
+  GLuint id = 0;
+  state buffer_state = state::unmapped;
+  uint8_t* mapped = nullptr;
+};
+
+std::vector<UploadBuffer> upload_buffers;
+std::mutex upload_buffer_mutex;
+size_t upload_buffer_size = 0;
+
+// Creates the pixel buffer objects, each large enough for a tile part of maximum size. Called on the render thread.
+void init_upload_buffers()
+{
+  if (num_upload_buffers == 0) {
+    return;
+  }
+
+  if (rlGetVersion() != RL_OPENGL_33 && rlGetVersion() != RL_OPENGL_43) {
+    fprintf(stderr, "Asynchronous texture upload needs OpenGL 3.3, falling back to synchronous upload\n");
+    num_upload_buffers = 0;
+    return;
+  }
+
+  upload_buffer_size = (size_t) max_texture_size * max_texture_size * 4;
+  upload_buffers.resize(num_upload_buffers);
+
+  for (auto& buffer : upload_buffers) {
+    glGenBuffers(1, &buffer.id);
+  }
+}
+
+// Maps all buffers that are not in use, so that decoding threads can fill them. Called on the render thread.
+void map_upload_buffers()
+{
+  std::lock_guard<std::mutex> lock(upload_buffer_mutex);
+
+  for (auto& buffer : upload_buffers) {
+    if (buffer.buffer_state == UploadBuffer::state::unmapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+
+      // Orphan the previous storage, which may still be in transfer, instead of waiting for it.
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) upload_buffer_size, nullptr, GL_STREAM_DRAW);
+      buffer.mapped = (uint8_t*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) upload_buffer_size,
+                                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+      if (buffer.mapped) {
+        buffer.buffer_state = UploadBuffer::state::available;
+      }
+    }
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Copies the pixels of the part into an available buffer, if there is one. Called on a decoding thread.
+void stage_tile_part(TilePart& part)
+{
+  size_t size = (size_t) part.image.width * part.image.height * 4;
+  if (size > upload_buffer_size) {
+    return;
+  }
+
+  UploadBuffer* buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(upload_buffer_mutex);
+    for (size_t i = 0; i < upload_buffers.size(); i++) {
+      if (upload_buffers[i].buffer_state == UploadBuffer::state::available) {
+        buffer = &upload_buffers[i];
+        buffer->buffer_state = UploadBuffer::state::filled;
+        part.upload_buffer = (int) i;
+        break;
+      }
+    }
+  }
+
+  if (!buffer) {
+    return; // all buffers in use, the part is uploaded from its pixel buffer
+  }
+
+  memcpy(buffer->mapped, part.image.data, size);
+
+  if (cpu_pixel_budget == 0) {
+    release_pixel_buffer(part.image);
+  }
+}
+
+// Creates the texture of the part from its pixel buffer object. Called on the render thread.
+Texture2D upload_tile_part_from_buffer(TilePart& part)
+{
+  Texture2D texture;
+  texture.width = part.image.width;
+  texture.height = part.image.height;
+  texture.mipmaps = 1;
+  texture.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+
+  // draw everything that uses the current GL state before changing the bindings
+  rlDrawRenderBatchActive();
+
+  // allocate the texture while no pixel buffer is bound, then fill it from the buffer
+  texture.id = rlLoadTexture(nullptr, texture.width, texture.height, texture.format, 1);
+
+  UploadBuffer& buffer = upload_buffers[part.upload_buffer];
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  glBindTexture(GL_TEXTURE_2D, texture.id);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture.width, texture.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  std::lock_guard<std::mutex> lock(upload_buffer_mutex);
+  buffer.mapped = nullptr;
+  buffer.buffer_state = UploadBuffer::state::unmapped;
+  part.upload_buffer = -1;
+
+  return texture;
+}
+
+// Frees the pixels of a part that has not been uploaded. A filled buffer stays mapped and becomes available again.
+void release_tile_part_pixels(TilePart& part)
+{
+  if (part.upload_buffer >= 0) {
+    std::lock_guard<std::mutex> lock(upload_buffer_mutex);
+    upload_buffers[part.upload_buffer].buffer_state = UploadBuffer::state::available;
+    part.upload_buffer = -1;
+  }
+
+  if (part.image.data) {
+    release_pixel_buffer(part.image);
+  }
+}
+
+// Called on the render thread after the decoding threads have been stopped
+void free_upload_buffers()
+{
+  for (auto& buffer : upload_buffers) {
+    if (buffer.mapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    glDeleteBuffers(1, &buffer.id);
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  upload_buffers.clear();
+}
+
+
+// --- CPU tier of the tile cache. The decoded pixels of the most recently used tiles are kept after the upload,
+//     so that pixel values can be read without decoding again, e.g. by the pixel inspector and the region statistics.
+
+size_t num_cpu_pixels = 0; // kept pixels of all tiles. Locked by 'tilemutex'.
+
+// Number of pixels of all parts of the tile
+size_t get_tile_pixels(const Tile& tile)
+{
+  size_t pixels = 0;
+  for (const auto& part : tile.parts) {
+    pixels += (size_t) part.image.width * part.image.height;
+  }
+
+  return pixels;
+}
+
+// The tile under the pixel inspector keeps its pixels regardless of the budget, also with a budget of 0.
+// Otherwise, it would be decoded again in every frame. Locked by 'tilemutex'.
+bool tile_inspected = false;
+TileKey inspected_tile{};
+
+// Releases the pixels that were kept after the upload. 'tilemutex' must be held.
+void release_cpu_pixels(Tile& tile)
+{
+  if (!tile.cpu_pixels) {
+    return;
+  }
+
+  for (auto& part : tile.parts) {
+    if (part.image.data) {
+      release_pixel_buffer(part.image);
+    }
+  }
+
+  tile.cpu_pixels = false;
+  num_cpu_pixels -= get_tile_pixels(tile);
+}
+
+// Releases the pixels of the least recently used tiles beyond 'cpu_pixel_budget', except for the inspected tile. 'tilemutex' must be held.
+void trim_cpu_tiles()
+{
+  while (num_cpu_pixels > cpu_pixel_budget) {
+    Tile* oldest = nullptr;
+    for (auto& t : tiles) {
+      if (t.cpu_pixels && !(tile_inspected && t.key == inspected_tile) && (!oldest || t.last_used_frame < oldest->last_used_frame)) {
+        oldest = &t;
+      }
+    }
+
+    if (!oldest) {
+      break;
+    }
+
+    release_cpu_pixels(*oldest);
+  }
+}
+
+// Called when all parts of the tile have been uploaded. Keeps their pixels in the CPU tier. 'tilemutex' must be held.
+void keep_cpu_pixels(Tile& tile)
+{
+  if (!tile.cpu_pixels) {
+    tile.cpu_pixels = true;
+    num_cpu_pixels += get_tile_pixels(tile);
+  }
+
+  trim_cpu_tiles();
+}
+
+// Sets the tile under the pixel inspector. The pixels of the previous one are released if they are over budget. 'tilemutex' must be held.
+void set_inspected_tile(bool inspected, const TileKey& key = {})
+{
+  if (inspected == tile_inspected && (!inspected || key == inspected_tile)) {
+    return;
+  }
+
+  tile_inspected = inspected;
+  inspected_tile = key;
+  trim_cpu_tiles();
+}
+
+// Returns the pixel at (x,y) of the tile if its pixels are in memory. 'tilemutex' must be held.
+bool get_tile_pixel(const Tile& tile, int x, int y, Color& color)
+{
+  for (const auto& part : tile.parts) {
+    if (x >= part.x && y >= part.y && x < part.x + part.image.width && y < part.y + part.image.height) {
+      if (!part.image.data) {
+        return false;
+      }
+
+      color = ((const Color*) part.image.data)[(y - part.y) * part.image.width + (x - part.x)];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+// Splits the pixels of a decoded tile into parts of at most 'max_texture_size'. The pixel buffer is passed on to the parts.
+std::vector<TilePart> split_tile(Color* pixels, int tile_width, int tile_height)
+{
+  auto make_image = [](void* data, int w, int h) {
+    return Image{
+        .data = data,
+        .width = w,
+        .height = h,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+    };
+  };
+
+  std::vector<TilePart> parts;
+
+  if (tile_width <= max_texture_size && tile_height <= max_texture_size) {
+    TilePart part;
+    part.x = part.y = 0;
+    part.image = make_image(pixels, tile_width, tile_height);
+    parts.push_back(part);
+    return parts;
+  }
+
+  for (int y0 = 0; y0 < tile_height; y0 += max_texture_size) {
+    for (int x0 = 0; x0 < tile_width; x0 += max_texture_size) {
+      int w = std::min(max_texture_size, tile_width - x0);
+      int h = std::min(max_texture_size, tile_height - y0);
+
+      Color* part_pixels = (Color*) allocate_pixel_buffer(w * h * sizeof(Color));
+      for (int y = 0; y < h; y++) {
+        memcpy(&part_pixels[y * w], &pixels[(y0 + y) * tile_width + x0], w * sizeof(Color));
+      }
+
+      TilePart part;
+      part.x = x0;
+      part.y = y0;
+      part.image = make_image(part_pixels, w, h);
+      parts.push_back(part);
+    }
+  }
+
+  Image full = make_image(pixels, tile_width, tile_height);
+  release_pixel_buffer(full);
+
+  return parts;
+}
+
+heif_decoding_options* alloc_decoding_options()
+{
+  heif_decoding_options* options = heif_decoding_options_alloc();
+#if !COUNT_ALLOCATIONS
+  allocations_by_thread++; // otherwise counted in operator new
+#endif
+  options->ignore_transformations = !decode_with_transformations();
+  options->decoder_id = decoder_id.empty() ? nullptr : decoder_id.c_str();
+
+  return options;
+}
+
+
+// Decodes the file tiles of a render tile of the full tile size and copies them into 'pixels'.
+// Returns the decoding time in ms. The file must have been acquired.
+double decode_render_tile(HeifFile& file, const TileKey& key, heif_decoding_options* options, Color* pixels, uint64_t& decoded_pixels)
+{
+  const Layer& layer = file.layers[key.layer];
+  int tile_width = (int) layer.tiling.tile_width;
+  int tile_height = (int) layer.tiling.tile_height;
+
+  const heif_image_tiling& file_tiling = layer.file_tiling;
+  uint32_t merge_x = layer.tiling.tile_width / file_tiling.tile_width;
+  uint32_t merge_y = layer.tiling.tile_height / file_tiling.tile_height;
+
+  uint32_t ftx0 = key.x * merge_x, ftx1 = std::min(ftx0 + merge_x, file_tiling.num_columns);
+  uint32_t fty0 = key.y * merge_y, fty1 = std::min(fty0 + merge_y, file_tiling.num_rows);
+
+  if (ftx1 - ftx0 < merge_x || fty1 - fty0 < merge_y) {
+    // render tile at the image border, partially outside of the image
+    memset(pixels, 0, tile_width * tile_height * sizeof(Color));
+  }
+
+  double decode_ms = 0;
+  decoded_pixels = 0;
+
+  if (file.scratch) {
+    auto start = std::chrono::steady_clock::now();
+    decode_scratch_image(file, options);
+    decode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  for (uint32_t fty = fty0; fty < fty1; fty++) {
+    for (uint32_t ftx = ftx0; ftx < ftx1; ftx++) {
+      heif_image* img = nullptr;
+      const uint8_t* data;
+      int stride, w, h;
+
+      if (file.scratch) {
+        // sliced image: copy the tile from the scratch file
+        data = scratch_tile(file, key.layer, ftx, fty);
+        stride = (int) scratch_tile_size * 4;
+        w = h = (int) scratch_tile_size;
+      }
+      else {
+        auto start = std::chrono::steady_clock::now();
+
+        heif_error err = heif_image_handle_decode_image_tile(layer.handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, options, ftx, fty);
+
+        decode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (err.code) {
+          printf("heif_decode_image error: %s\n", err.message);
+          exit(0);
+        }
+
+        data = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+
+        w = std::min(heif_image_get_width(img, heif_channel_interleaved), (int) file_tiling.tile_width);
+        h = std::min(heif_image_get_height(img, heif_channel_interleaved), (int) file_tiling.tile_height);
+      }
+      int x0 = (int) ((ftx - ftx0) * file_tiling.tile_width);
+      int y0 = (int) ((fty - fty0) * file_tiling.tile_height);
+      decoded_pixels += (uint64_t) w * h;
+
+      // Fill the image with RGB pixels
+      for (int y = 0; y < h; y++) {
+        memcpy(&pixels[(y0 + y) * tile_width + x0], data + y * stride, w * 4);
+      }
+
+      if (img) {
+        heif_image_release(img);
+      }
+    }
+  }
+
+  return decode_ms;
+}
+
+
+// --- Image statistics for auto-levels. Each decoded tile is counted once into the histogram of its layer. The coarsest
+//     layer is decoded completely in the background and gives a first estimate. It is replaced by a finer layer
+//     as soon as all tiles of that layer have been counted.
+
+bool auto_levels = false;
+std::atomic<bool> count_histograms{false}; // set when auto-levels is turned on the first time. Until then, decoded tiles are not counted.
+const float auto_levels_clip = 0.005f; // share of the pixels that is clipped at each end of the histogram
+const uint32_t histogram_max_coarse_tiles = 64; // no background decoding for images without a small pyramid layer
+
+// Counts the RGB values of a w x h area of the pixels. Four partial histograms are counted in turn, so that
+// consecutive pixels with the same value do not have to wait for each other's increment.
+void count_histogram(const Color* pixels, int stride, int w, int h, Histogram& histogram)
+{
+  static thread_local uint32_t partial[4][3][256];
+  memset(partial, 0, sizeof(partial));
+
+  for (int y = 0; y < h; y++) {
+    const Color* row = pixels + (size_t) y * stride;
+
+    int x = 0;
+    for (; x + 4 <= w; x += 4) {
+      for (int i = 0; i < 4; i++) {
+        partial[i][0][row[x + i].r]++;
+        partial[i][1][row[x + i].g]++;
+        partial[i][2][row[x + i].b]++;
+      }
+    }
+
+    for (; x < w; x++) {
+      partial[0][0][row[x].r]++;
+      partial[0][1][row[x].g]++;
+      partial[0][2][row[x].b]++;
+    }
+  }
+
+  for (int c = 0; c < 3; c++) {
+    for (int v = 0; v < 256; v++) {
+      histogram.counts[c][v] += partial[0][c][v] + partial[1][c][v] + partial[2][c][v] + partial[3][c][v];
+    }
+  }
+
+  histogram.pixels += (uint64_t) w * h;
+}
+
+// Counts the pixels of a decoded tile that are inside of the image
+void count_tile_histogram(const Layer& layer, const TileKey& key, const Color* pixels, Histogram& histogram)
+{
+  int tile_width = (int) layer.tiling.tile_width;
+  int tile_height = (int) layer.tiling.tile_height;
+  int valid_width = std::min(tile_width, (int) layer.tiling.image_width - key.x * tile_width);
+  int valid_height = std::min(tile_height, (int) layer.tiling.image_height - key.y * tile_height);
+  count_histogram(pixels, tile_width, valid_width, valid_height, histogram);
+}
+
+// Adds the histogram of a decoded tile to its layer, unless it has been counted already. 'tilemutex' must be held.
+void add_tile_histogram(Layer& layer, int tx, int ty, const Histogram& histogram)
+{
+  size_t num_tiles = (size_t) layer.tiling.num_columns * layer.tiling.num_rows;
+  if (layer.histogram_tiles.empty()) {
+    layer.histogram_tiles.resize(num_tiles);
+  }
+
+  size_t idx = (size_t) ty * layer.tiling.num_columns + tx;
+  if (layer.histogram_tiles[idx]) {
+    return;
+  }
+
+  layer.histogram_tiles[idx] = true;
+  layer.histogram_tiles_counted++;
+
+  for (int c = 0; c < 3; c++) {
+    for (int v = 0; v < 256; v++) {
+      layer.histogram.counts[c][v] += histogram.counts[c][v];
+    }
+  }
+
+  layer.histogram.pixels += histogram.pixels;
+}
+
+// Returns the histogram of the finest completely counted layer, or else of the layer counted to the largest part.
+// nullptr if no tile has been counted yet. 'tilemutex' must be held.
+const Histogram* get_file_histogram(const HeifFile& file)
+{
+  const Histogram* best = nullptr;
+  double best_coverage = 0;
+
+  for (const auto& layer : file.layers) {
+    double coverage = (double) layer.histogram_tiles_counted / ((double) layer.tiling.num_columns * layer.tiling.num_rows);
+    if (coverage > 0 && coverage >= best_coverage) {
+      best = &layer.histogram;
+      best_coverage = coverage;
+    }
+  }
+
+  return best;
+}
+
+// Black and white point of each channel, clipping 'auto_levels_clip' of the pixels at both ends
+void get_auto_levels(const Histogram& histogram, float black[3], float white[3])
+{
+  uint64_t clip = (uint64_t) ((double) histogram.pixels * auto_levels_clip);
+
+  for (int c = 0; c < 3; c++) {
+    int lo = 0, hi = 255;
+    for (uint64_t sum = 0; lo < 255 && (sum += histogram.counts[c][lo]) <= clip; lo++) {
+    }
+    for (uint64_t sum = 0; hi > 0 && (sum += histogram.counts[c][hi]) <= clip; hi--) {
+    }
+
+    if (hi <= lo) {
+      lo = 0;
+      hi = 255;
+    }
+
+    black[c] = (float) lo / 255;
+    white[c] = (float) hi / 255;
+  }
+}
+
+
+// Decodes the tile with the decoding thread's options. Fresh options are used if 'reuse_decode_state' is false.
+// 'visible' is true if the tile was requested at visible priority.
+void load_tile(const TileKey& key, heif_decoding_options* worker_options, bool visible)
+{
+  // Skip tiles that have been evicted from the cache while waiting in the decoding queue.
+
+  tilemutex.lock();
+  bool still_needed = (find_tile(key) != nullptr);
+  tilemutex.unlock();
+
+  if (!still_needed) {
+    return;
+  }
+
+  printf("loading Tile %d;%d, layer: %d, file: %d\n", key.x, key.y, key.layer, key.file);
+
+  HeifFile& file = acquire_file(key.file);
+
+  Layer& layer = file.layers[key.layer];
+  int tile_width = (int) layer.tiling.tile_width;
+  int tile_height = (int) layer.tiling.tile_height;
+
+  uint64_t allocations_start = allocations_by_thread;
+
+  heif_decoding_options* options = reuse_decode_state ? worker_options : alloc_decoding_options();
+
+  Color* pixels = (Color*) allocate_pixel_buffer(tile_width * tile_height * sizeof(Color));
+
+  bytes_read_by_thread = 0;
+  uint64_t decoded_pixels;
+  double decode_ms = decode_render_tile(file, key, options, pixels, decoded_pixels);
+
+  if (!reuse_decode_state) {
+    heif_decoding_options_free(options);
+  }
+
+  release_file(file);
+
+  Histogram histogram;
+  bool counted = count_histograms;
+  if (counted) {
+    count_tile_histogram(layer, key, pixels, histogram);
+  }
+
+  std::vector<TilePart> parts = split_tile(pixels, tile_width, tile_height);
+
+  // Only visible tiles are staged. Prefetched tiles may never be drawn and would hold the buffers of the ring.
+
+  if (num_upload_buffers > 0 && visible) {
+    for (auto& part : parts) {
+      stage_tile_part(part);
+    }
+  }
+
+  tilemutex.lock();
+
+  View& view = views[file.view];
+  view.tiles_decoded++;
+  view.total_decode_ms += decode_ms;
+  view.last_decode_ms = decode_ms;
+
+  DecodeProfile& profile = decode_profiles[{key.layer, layer.item_type}];
+  profile.decode_ms.push_back((float) decode_ms);
+  profile.bytes_read += bytes_read_by_thread;
+  profile.pixels += decoded_pixels;
+  profile.allocations += allocations_by_thread - allocations_start;
+
+  HeatmapCell& cell = layer.heatmap_cell(key.x, key.y);
+  cell.decodes++;
+  cell.last_decode_ms = (float) decode_ms;
+  layer.heatmap_max_decode_ms = std::max(layer.heatmap_max_decode_ms, cell.last_decode_ms);
+
+  if (counted) {
+    add_tile_histogram(layer, key.x, key.y, histogram);
+  }
+
+  Tile* tile = find_tile(key);
+  if (tile) {
+    if (counted) {
+      release_histogram_pin(*tile);
+    }
+
+    tile->state = tile_state::waiting_for_texture_upload;
+    tile->parts = std::move(parts);
+  }
+  else {
+    for (auto& part : parts) {
+      release_tile_part_pixels(part);
+    }
+  }
+  tilemutex.unlock();
+}
+
+// Decodes a tile whose pixels have been released after the upload again and puts them into the CPU tier.
+// The textures stay as they are. Also counts tiles that have been decoded before the histograms were counted.
+void load_tile_pixels(const TileKey& key, heif_decoding_options* options)
+{
+  HeifFile& file = acquire_file(key.file);
+
+  Layer& layer = file.layers[key.layer];
+  int tile_width = (int) layer.tiling.tile_width;
+  int tile_height = (int) layer.tiling.tile_height;
+
+  Color* pixels = (Color*) allocate_pixel_buffer(tile_width * tile_height * sizeof(Color));
+
+  uint64_t decoded_pixels;
+  decode_render_tile(file, key, options, pixels, decoded_pixels);
+  release_file(file);
+
+  Histogram histogram;
+  bool counted = count_histograms;
+  if (counted) {
+    count_tile_histogram(layer, key, pixels, histogram);
+  }
+
+  std::vector<TilePart> parts = split_tile(pixels, tile_width, tile_height);
+
+  std::lock_guard<std::mutex> lock(tilemutex);
+
+  if (counted) {
+    add_tile_histogram(layer, key.x, key.y, histogram);
+  }
+
+  Tile* tile = find_tile(key);
+  if (tile) {
+    if (counted) {
+      release_histogram_pin(*tile);
+    }
+
+    tile->pixels_requested = false;
+
+    if (tile->state == tile_state::ready && !tile->cpu_pixels && tile->parts.size() == parts.size()) {
+      for (size_t i = 0; i < parts.size(); i++) {
+        tile->parts[i].image.data = parts[i].image.data;
+        parts[i].image.data = nullptr;
+      }
+
+      keep_cpu_pixels(*tile);
+    }
+  }
+
+  for (auto& part : parts) {
+    release_tile_part_pixels(part);
+  }
+}
+
+
+// --- Decoding thread pool, shared by all files
+
+struct DecodeRequest
+{
+  enum class type
+  {
+    tile,
+    open_file,   // only open the file to get its metadata
+    region_tile, // count the pixels of the tile for the region statistics
+    tile_pixels  // decode the pixels of an uploaded tile again for the CPU tier
+  };
+
+  type request_type;
+  TileKey key;
+  uint32_t generation = 0; // of the region statistics
+};
+
+enum class request_priority
+{
+  visible,
+  prefetch
+};
+
+std::deque<DecodeRequest> decode_queue;    // visible tiles, decoded first
+std::deque<DecodeRequest> prefetch_queue;  // tiles that will probably become visible soon, newest first
+std::deque<DecodeRequest> region_queue;    // tiles of the region statistics, decoded when nothing else is to do
+size_t max_prefetch_requests = 32;
+std::mutex decode_queue_mutex;
+std::condition_variable decode_queue_cond;
+std::vector<std::thread> decode_threads;
+bool decode_pool_shutdown = false;
+
+// Counts the pixels of a tile for the region statistics. Defined with the region statistics.
+void count_region_tile(const DecodeRequest& request, heif_decoding_options* options);
+
+void decode_thread_main()
+{
+  // The decoding options are allocated once per thread and used for all its tiles.
+  heif_decoding_options* options = alloc_decoding_options();
+
+  for (;;) {
+    std::unique_lock<std::mutex> lock(decode_queue_mutex);
+    decode_queue_cond.wait(lock, [] { return decode_pool_shutdown || !decode_queue.empty() || !prefetch_queue.empty() || !region_queue.empty(); });
+
+    if (decode_pool_shutdown) {
+      heif_decoding_options_free(options);
+      return;
+    }
+
+    std::deque<DecodeRequest>& queue = !decode_queue.empty() ? decode_queue : !prefetch_queue.empty() ? prefetch_queue : region_queue;
+    DecodeRequest request = queue.front();
+    queue.pop_front();
+    lock.unlock();
+
+    if (request.request_type == DecodeRequest::type::open_file) {
+      release_file(acquire_file(request.key.file));
+    }
+    else if (request.request_type == DecodeRequest::type::region_tile) {
+      count_region_tile(request, options);
+    }
+    else if (request.request_type == DecodeRequest::type::tile_pixels) {
+      load_tile_pixels(request.key, options);
+    }
+    else {
+      load_tile(request.key, options, &queue == &decode_queue);
+    }
+  }
+}
+
+void start_decode_pool()
+{
+  for (int i = 0; i < num_decode_threads; i++) {
+    decode_threads.emplace_back(decode_thread_main);
+  }
+}
+
+void stop_decode_pool()
+{
+  decode_queue_mutex.lock();
+  decode_pool_shutdown = true;
+  decode_queue_mutex.unlock();
+
+  decode_queue_cond.notify_all();
+
+  for (auto& thread : decode_threads) {
+    thread.join();
+  }
+}
+
+// Requests decoding of a tile that has been added to the cache. 'tilemutex' must be held.
+void request_tile(const TileKey& key, request_priority priority)
+{
+  decode_queue_mutex.lock();
+
+  if (priority == request_priority::visible) {
+    decode_queue.push_back({DecodeRequest::type::tile, key});
+  }
+  else {
+    prefetch_queue.push_front({DecodeRequest::type::tile, key});
+
+    // Drop the oldest prefetch request. Its prediction is probably outdated.
+
+    if (prefetch_queue.size() > max_prefetch_requests) {
+      remove_loading_tile(prefetch_queue.back().key);
+      prefetch_queue.pop_back();
+    }
+  }
+
+  decode_queue_mutex.unlock();
+
+  decode_queue_cond.notify_one();
+}
+
+// Requests decoding the pixels of an uploaded tile again. They are needed right now, so the request is
+// served before all other tiles. 'tilemutex' must be held.
+void request_tile_pixels(Tile& tile)
+{
+  if (tile.pixels_requested) {
+    return;
+  }
+
+  tile.pixels_requested = true;
+
+  decode_queue_mutex.lock();
+  decode_queue.push_front({DecodeRequest::type::tile_pixels, tile.key});
+  decode_queue_mutex.unlock();
+
+  decode_queue_cond.notify_one();
+}
+
+// Moves the request of a prefetched tile that is visible now to the decoding queue of visible tiles.
+void promote_tile_request(const TileKey& key)
+{
+  std::lock_guard<std::mutex> lock(decode_queue_mutex);
+
+  for (size_t i = 0; i < prefetch_queue.size(); i++) {
+    if (prefetch_queue[i].key == key) {
+      decode_queue.push_back(prefetch_queue[i]);
+      prefetch_queue.erase(prefetch_queue.begin() + (long) i);
+      return;
+    }
+  }
+}
+
+// Moves the request of a tile to the front of the decoding queue, so that it is decoded next.
+void prioritize_tile_request(const TileKey& key)
+{
+  std::lock_guard<std::mutex> lock(decode_queue_mutex);
+
+  for (auto* queue : {&decode_queue, &prefetch_queue}) {
+    for (size_t i = 0; i < queue->size(); i++) {
+      if ((*queue)[i].request_type == DecodeRequest::type::tile && (*queue)[i].key == key) {
+        DecodeRequest request = (*queue)[i];
+        queue->erase(queue->begin() + (long) i);
+        decode_queue.push_front(request);
+        return;
+      }
+    }
+  }
+}
+
+// Drops all waiting tile requests, e.g. after jumping to a different position. 'tilemutex' must be held.
+void cancel_tile_requests()
+{
+  std::lock_guard<std::mutex> lock(decode_queue_mutex);
+
+  for (auto* queue : {&decode_queue, &prefetch_queue}) {
+    std::deque<DecodeRequest> remaining;
+    for (const auto& request : *queue) {
+      const Tile* tile = find_tile(request.key);
+      if (request.request_type == DecodeRequest::type::tile && !(tile && tile->cls == cache_class::pinned)) {
+        remove_loading_tile(request.key);
+      }
+      else {
+        remaining.push_back(request);
+      }
+    }
+
+    queue->swap(remaining);
+  }
+}
+
+bool decode_queues_empty()
+{
+  std::lock_guard<std::mutex> lock(decode_queue_mutex);
+  return decode_queue.empty() && prefetch_queue.empty();
+}
+
+void request_file_open(uint32_t file_idx)
+{
+  decode_queue_mutex.lock();
+  decode_queue.push_back({DecodeRequest::type::open_file, {file_idx, 0, 0, 0}});
+  decode_queue_mutex.unlock();
+
+  decode_queue_cond.notify_one();
+}
+
+
+// --- Auto-tuning of the decoding. Parallel decoding of tiles in the pool competes with the threads that libheif
+//     uses within one tile, and libheif may have several decoders for a codec. The best choice depends on the codec,
+//     the tile size and the machine.
+
+// Returns up to 'num_tiles' file tiles from the center of the layer
+std::vector<std::pair<int, int>> center_tiles(const Layer& layer, size_t num_tiles)
+{
+  const heif_image_tiling& tiling = layer.file_tiling;
+
+  num_tiles = std::min(num_tiles, (size_t) tiling.num_columns * tiling.num_rows);
+  int side = (int) std::ceil(std::sqrt((double) num_tiles));
+  int tx0 = std::max(0, (int) tiling.num_columns / 2 - side / 2);
+  int ty0 = std::max(0, (int) tiling.num_rows / 2 - side / 2);
+
+  std::vector<std::pair<int, int>> tiles;
+  for (int ty = ty0; ty < (int) tiling.num_rows && tiles.size() < num_tiles; ty++) {
+    for (int tx = tx0; tx < (int) tiling.num_columns && tx < tx0 + side && tiles.size() < num_tiles; tx++) {
+      tiles.emplace_back(tx, ty);
+    }
+  }
+
+  return tiles;
+}
+
+// Decodes the tiles with 'pool_size' threads in parallel and 'libheif_threads' threads per tile (0 = keep the current setting),
+// using the decoder 'decoder' (empty = libheif's default). Returns the throughput in MPix/s, or -1 if the decoder cannot decode the tiles.
+double measure_decoding_throughput(HeifFile& file, const Layer& layer, const std::vector<std::pair<int, int>>& tiles,
+                                   int pool_size, int libheif_threads, const std::string& decoder)
+{
+  if (libheif_threads > 0) {
+    heif_context_set_max_decoding_threads(file.ctx, libheif_threads);
+  }
+
+  std::atomic<size_t> next_tile{0};
+  std::atomic<bool> failed{false};
+  std::vector<std::thread> threads;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < pool_size; i++) {
+    threads.emplace_back([&] {
+      heif_decoding_options* options = heif_decoding_options_alloc();
+      options->ignore_transformations = !decode_with_transformations();
+      options->decoder_id = decoder.empty() ? nullptr : decoder.c_str();
+
+      for (size_t t = next_tile++; t < tiles.size() && !failed; t = next_tile++) {
+        heif_image* img;
+        heif_error err = heif_image_handle_decode_image_tile(layer.handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, options,
+                                                             tiles[t].first, tiles[t].second);
+        if (err.code == heif_error_Ok) {
+          heif_image_release(img);
+        }
+        else {
+          failed = true;
+        }
+      }
+
+      heif_decoding_options_free(options);
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (failed) {
+    return -1;
+  }
+
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  double pixels = (double) tiles.size() * layer.file_tiling.tile_width * layer.file_tiling.tile_height;
+
+  return ms > 0 ? pixels / 1e3 / ms : 0;
+}
+
+// Decodes tiles from the center of the first file's full resolution layer with pool sizes from the number of cores down to 1.
+// The libheif threads make up for the remaining cores. Sets the configuration with the highest throughput.
+void auto_tune_threading()
+{
+  int cores = (int) std::max(1U, std::thread::hardware_concurrency());
+
+  HeifFile& file = acquire_file(0);
+  if (file.scratch) {
+    printf("no thread auto-tuning for images without tiling\n");
+    release_file(file);
+    return;
+  }
+  const Layer& layer = file.layers.back();
+  const heif_image_tiling& tiling = layer.file_tiling;
+
+  std::vector<std::pair<int, int>> tiles = center_tiles(layer, 2 * cores);
+
+  printf("auto-tuning threads with %zu tiles of %ux%u pixels:\n", tiles.size(), tiling.tile_width, tiling.tile_height);
+
+  // the first run reads the tiles into the operating system's file cache and is not counted
+  measure_decoding_throughput(file, layer, tiles, cores, 1, decoder_id);
+
+  double best_mpix = 0;
+  for (int pool_size = cores; pool_size >= 1; pool_size /= 2) {
+    int libheif_threads = std::max(1, cores / pool_size);
+    double mpix = measure_decoding_throughput(file, layer, tiles, pool_size, libheif_threads, decoder_id);
+    printf("  %3d decoding threads x %3d libheif threads: %8.2f MPix/s\n", pool_size, libheif_threads, mpix);
+
+    if (mpix > best_mpix) {
+      best_mpix = mpix;
+      num_decode_threads = pool_size;
+      libheif_decoding_threads = libheif_threads;
+    }
+  }
+
+  printf("using %d decoding threads x %d libheif threads\n", num_decode_threads, libheif_decoding_threads);
+
+  release_file(file);
+
+  // --- apply to the files that are open already
+
+  std::lock_guard<std::mutex> lock(filemutex);
+  for (auto& f : files) {
+    if (f.ctx) {
+      heif_context_set_max_decoding_threads(f.ctx, libheif_decoding_threads);
+    }
+  }
+}
+
+// Returns the ids of all decoder plugins available in libheif, for all codecs
+std::vector<std::string> get_decoder_ids()
+{
+  const int max_decoders = 50;
+  const heif_decoder_descriptor* descriptors[max_decoders];
+  int num_decoders = heif_get_decoder_descriptors(heif_compression_undefined, descriptors, max_decoders);
+
+  std::vector<std::string> ids;
+  for (int i = 0; i < num_decoders; i++) {
+    ids.emplace_back(heif_decoder_descriptor_get_id_name(descriptors[i]));
+  }
+
+  return ids;
+}
+
+// Decodes tiles from the center of the first file's full resolution layer with every decoder that supports its codec
+// and selects the fastest one.
+void select_fastest_decoder()
+{
+  HeifFile& file = acquire_file(0);
+  if (file.scratch) {
+    printf("no decoder selection for images without tiling\n");
+    release_file(file);
+    return;
+  }
+  const Layer& layer = file.layers.back();
+
+  std::vector<std::pair<int, int>> tiles = center_tiles(layer, 2 * num_decode_threads);
+
+  printf("comparing decoders with %zu tiles of %ux%u pixels:\n", tiles.size(), layer.file_tiling.tile_width, layer.file_tiling.tile_height);
+
+  // the first run reads the tiles into the operating system's file cache and is not counted
+  measure_decoding_throughput(file, layer, tiles, num_decode_threads, libheif_decoding_threads, "");
+
+  double best_mpix = 0;
+  for (const auto& id : get_decoder_ids()) {
+    double mpix = measure_decoding_throughput(file, layer, tiles, num_decode_threads, libheif_decoding_threads, id);
+    if (mpix < 0) {
+      printf("  %-16s cannot decode this image\n", id.c_str());
+      continue;
+    }
+
+    printf("  %-16s %8.2f MPix/s\n", id.c_str(), mpix);
+
+    if (mpix > best_mpix) {
+      best_mpix = mpix;
+      decoder_id = id;
+    }
+  }
+
+  printf("using decoder %s\n", decoder_id.empty() ? "(default)" : decoder_id.c_str());
+
+  release_file(file);
+}
+
+
+// --- Tone adjustments, applied by a fragment shader when the tiles are drawn. Changing them needs no decoding and no texture upload.
+
+struct ToneAdjustment
+{
+  float brightness = 0; // added to each channel
+  float contrast = 1;   // scaling around mid gray
+  float gamma = 1;
+  std::string swizzle = "rgb"; // source channels of the red, green and blue output
+  std::string false_color;     // LUT applied to the luminance, empty = off
+
+  bool is_neutral() const
+  {
+    return brightness == 0 && contrast == 1 && gamma == 1 && swizzle == "rgb" && false_color.empty();
+  }
+};
+
+ToneAdjustment tone;
+
+const char* swizzles[] = {"rgb", "bgr", "rrr", "ggg", "bbb"}; // cycled through with the 'S' key
+const char* false_color_luts[] = {"heat", "rainbow", "viridis"};
+
+const char* tile_fragment_shader = R"(
+#version 330
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+uniform float brightness;
+uniform float contrast;
+uniform float gamma;
+uniform ivec3 swizzle;
+uniform int use_false_color;
+uniform sampler2D false_color;
+uniform int use_color_lut;
+uniform sampler2D color_lut;
+uniform float color_lut_size;
+uniform vec3 levels_black;
+uniform vec3 levels_white;
+
+out vec4 finalColor;
+
+// The 3D LUT is stored as 2D texture with one slice per blue value side by side. Red and green are
+// interpolated by the texture filter, blue between the two nearest slices.
+vec3 apply_color_lut(vec3 c)
+{
+  float n = color_lut_size;
+  float b = c.b * (n - 1.0);
+  float b0 = floor(b);
+  float b1 = min(b0 + 1.0, n - 1.0);
+
+  vec2 rg = (c.rg * (n - 1.0) + 0.5) / vec2(n * n, n);
+  vec3 c0 = texture(color_lut, rg + vec2(b0 / n, 0.0)).rgb;
+  vec3 c1 = texture(color_lut, rg + vec2(b1 / n, 0.0)).rgb;
+
+  return mix(c0, c1, b - b0);
+}
+
+void main()
+{
+  vec4 texel = texture(texture0, fragTexCoord);
+  texel.rgb = clamp((texel.rgb - levels_black) / (levels_white - levels_black), 0.0, 1.0);
+
+  if (use_color_lut != 0) {
+    texel.rgb = apply_color_lut(texel.rgb);
+  }
+
+  vec3 c = vec3(texel[swizzle.x], texel[swizzle.y], texel[swizzle.z]);
+
+  c = (c - 0.5) * contrast + 0.5 + brightness;
+  c = pow(clamp(c, 0.0, 1.0), vec3(1.0 / gamma));
+
+  if (use_false_color != 0) {
+    float luminance = dot(c, vec3(0.2126, 0.7152, 0.0722));
+    c = texture(false_color, vec2(luminance, 0.5)).rgb;
+  }
+
+  finalColor = vec4(c, texel.a) * fragColor * colDiffuse;
+}
+)";
+
+// The LUTs are bound to texture units that raylib's batches do not use. Textures bound with
+// SetShaderValueTexture() are only kept until the next batch is drawn, which happens many times per frame.
+const int false_color_texture_unit = 7;
+const int color_lut_texture_unit = 6;
+
+bool tile_shader_loaded = false;
+bool tile_shader_active = false; // between begin_tile_shader() and end_tile_shader()
+Shader tile_shader;
+Texture2D false_color_texture;
+std::string false_color_texture_name; // LUT currently in 'false_color_texture'
+
+int brightness_loc, contrast_loc, gamma_loc, swizzle_loc, use_false_color_loc, false_color_loc;
+int use_color_lut_loc, color_lut_loc, color_lut_size_loc, levels_black_loc, levels_white_loc;
+
+bool is_valid_swizzle(const std::string& swizzle)
+{
+  return swizzle.size() == 3 && swizzle.find_first_not_of("rgb") == std::string::npos;
+}
+
+bool is_valid_false_color(const std::string& name)
+{
+  return name.empty() || std::find(std::begin(false_color_luts), std::end(false_color_luts), name) != std::end(false_color_luts);
+}
+
+// Interpolates the 256 entries of the LUT linearly between equidistant control colors
+void fill_false_color_lut(const std::string& name, Color lut[256])
+{
+  std::vector<Color> stops;
+  if (name == "heat") {
+    stops = {{0, 0, 0, 255}, {180, 0, 0, 255}, {255, 160, 0, 255}, {255, 255, 255, 255}};
+  }
+  else if (name == "rainbow") {
+    stops = {{0, 0, 255, 255}, {0, 255, 255, 255}, {0, 255, 0, 255}, {255, 255, 0, 255}, {255, 0, 0, 255}};
+  }
+  else {
+    stops = {{68, 1, 84, 255}, {59, 82, 139, 255}, {33, 145, 140, 255}, {94, 201, 98, 255}, {253, 231, 37, 255}};
+  }
+
+  for (int i = 0; i < 256; i++) {
+    float pos = (float) i / 255 * (float) (stops.size() - 1);
+    size_t k = std::min((size_t) pos, stops.size() - 2);
+    float t = pos - (float) k;
+
+    const Color& a = stops[k];
+    const Color& b = stops[k + 1];
+    lut[i] = {(unsigned char) std::lround(a.r + (b.r - a.r) * t),
+              (unsigned char) std::lround(a.g + (b.g - a.g) * t),
+              (unsigned char) std::lround(a.b + (b.b - a.b) * t),
+              255};
+  }
+}
+
+// Called on the render thread after the window has been opened
+void init_tile_shader()
+{
+  if (rlGetVersion() != RL_OPENGL_33 && rlGetVersion() != RL_OPENGL_43) {
+    fprintf(stderr, "Tone adjustments need OpenGL 3.3 and are disabled\n");
+    return;
+  }
+
+  tile_shader = LoadShaderFromMemory(nullptr, tile_fragment_shader);
+  brightness_loc = GetShaderLocation(tile_shader, "brightness");
+  contrast_loc = GetShaderLocation(tile_shader, "contrast");
+  gamma_loc = GetShaderLocation(tile_shader, "gamma");
+  swizzle_loc = GetShaderLocation(tile_shader, "swizzle");
+  use_false_color_loc = GetShaderLocation(tile_shader, "use_false_color");
+  false_color_loc = GetShaderLocation(tile_shader, "false_color");
+  use_color_lut_loc = GetShaderLocation(tile_shader, "use_color_lut");
+  color_lut_loc = GetShaderLocation(tile_shader, "color_lut");
+  color_lut_size_loc = GetShaderLocation(tile_shader, "color_lut_size");
+  levels_black_loc = GetShaderLocation(tile_shader, "levels_black");
+  levels_white_loc = GetShaderLocation(tile_shader, "levels_white");
+
+  Color lut[256];
+  fill_false_color_lut(false_color_luts[0], lut);
+  false_color_texture = LoadTextureFromImage(Image{lut, 256, 1, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8});
+  SetTextureFilter(false_color_texture, TEXTURE_FILTER_BILINEAR);
+  false_color_texture_name = false_color_luts[0];
+
+  tile_shader_loaded = true;
+}
+
+void free_tile_shader()
+{
+  for (auto& file : files) {
+    if (file.color_lut_texture.id) {
+      UnloadTexture(file.color_lut_texture);
+    }
+  }
+
+  if (tile_shader_loaded) {
+    UnloadTexture(false_color_texture);
+    UnloadShader(tile_shader);
+    tile_shader_loaded = false;
+  }
+}
+
+// Draws the following tiles of the file with its color conversion, auto-levels and the current tone adjustments.
+// Nothing is changed if there is nothing to do. 'tilemutex' must be held.
+void begin_tile_shader(HeifFile& file)
+{
+  bool use_color_lut = !file.color_lut.empty();
+
+  if (!tile_shader_loaded || (tone.is_neutral() && !use_color_lut && !auto_levels)) {
+    return;
+  }
+
+  float black[3] = {0, 0, 0}, white[3] = {1, 1, 1};
+  if (auto_levels) {
+    if (const Histogram* histogram = get_file_histogram(file)) {
+      get_auto_levels(*histogram, black, white);
+    }
+  }
+
+  if (use_color_lut && file.color_lut_texture.id == 0) {
+    file.color_lut_texture = LoadTextureFromImage(Image{file.color_lut.data(), color_lut_size * color_lut_size, color_lut_size,
+                                                        1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8});
+    SetTextureFilter(file.color_lut_texture, TEXTURE_FILTER_BILINEAR);
+  }
+
+  if (!tone.false_color.empty() && tone.false_color != false_color_texture_name) {
+    Color lut[256];
+    fill_false_color_lut(tone.false_color, lut);
+    UpdateTexture(false_color_texture, lut);
+    false_color_texture_name = tone.false_color;
+  }
+
+  BeginShaderMode(tile_shader);
+
+  int swizzle[3];
+  for (int i = 0; i < 3; i++) {
+    swizzle[i] = (tone.swizzle[i] == 'r') ? 0 : (tone.swizzle[i] == 'g') ? 1 : 2;
+  }
+
+  int use_false_color = tone.false_color.empty() ? 0 : 1;
+  int use_color_lut_flag = use_color_lut ? 1 : 0;
+  float lut_size = (float) color_lut_size;
+
+  SetShaderValue(tile_shader, brightness_loc, &tone.brightness, SHADER_UNIFORM_FLOAT);
+  SetShaderValue(tile_shader, contrast_loc, &tone.contrast, SHADER_UNIFORM_FLOAT);
+  SetShaderValue(tile_shader, gamma_loc, &tone.gamma, SHADER_UNIFORM_FLOAT);
+  SetShaderValue(tile_shader, swizzle_loc, swizzle, SHADER_UNIFORM_IVEC3);
+  SetShaderValue(tile_shader, use_false_color_loc, &use_false_color, SHADER_UNIFORM_INT);
+  SetShaderValue(tile_shader, false_color_loc, &false_color_texture_unit, SHADER_UNIFORM_INT);
+  SetShaderValue(tile_shader, use_color_lut_loc, &use_color_lut_flag, SHADER_UNIFORM_INT);
+  SetShaderValue(tile_shader, color_lut_loc, &color_lut_texture_unit, SHADER_UNIFORM_INT);
+  SetShaderValue(tile_shader, color_lut_size_loc, &lut_size, SHADER_UNIFORM_FLOAT);
+  SetShaderValue(tile_shader, levels_black_loc, black, SHADER_UNIFORM_VEC3);
+  SetShaderValue(tile_shader, levels_white_loc, white, SHADER_UNIFORM_VEC3);
+
+  glActiveTexture(GL_TEXTURE0 + false_color_texture_unit);
+  glBindTexture(GL_TEXTURE_2D, false_color_texture.id);
+  glActiveTexture(GL_TEXTURE0 + color_lut_texture_unit);
+  glBindTexture(GL_TEXTURE_2D, use_color_lut ? file.color_lut_texture.id : 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  tile_shader_active = true;
+}
+
+void end_tile_shader()
+{
+  if (tile_shader_active) {
+    EndShaderMode();
+    tile_shader_active = false;
+  }
+}
+
+std::string tone_description()
+{
+  char text[200];
+  snprintf(text, sizeof(text), "brightness %+.2f  contrast %.2f  gamma %.2f  %s  %s%s", tone.brightness, tone.contrast, tone.gamma,
+           tone.swizzle.c_str(), tone.false_color.empty() ? "" : tone.false_color.c_str(), auto_levels ? "  auto-levels" : "");
+  return text;
+}
+
+
+// --- Drawing
+
+// Window area of a layer in its untransformed orientation. Tiles are positioned in this area and then mapped
+// into the window with the orientation of the layer.
+struct OrientedArea
+{
+  Orientation orientation;
+  Rectangle area{0, 0, 0, 0};
+
+  // Maps a rectangle of the untransformed area into the window
+  Rectangle to_window(Rectangle r) const
+  {
+    if (orientation.is_identity()) {
+      return r;
+    }
+
+    Vector2 a = orientation.apply({r.x - area.x, r.y - area.y}, area.width, area.height);
+    Vector2 b = orientation.apply({r.x + r.width - area.x, r.y + r.height - area.y}, area.width, area.height);
+    return {area.x + std::min(a.x, b.x), area.y + std::min(a.y, b.y), std::abs(b.x - a.x), std::abs(b.y - a.y)};
+  }
+
+  // Maps a window position into the untransformed area
+  Vector2 to_layer(Vector2 p) const
+  {
+    if (orientation.is_identity()) {
+      return p;
+    }
+
+    float w = orientation.transpose ? area.height : area.width;
+    float h = orientation.transpose ? area.width : area.height;
+    Vector2 q = orientation.inverse().apply({p.x - area.x, p.y - area.y}, w, h);
+    return {area.x + q.x, area.y + q.y};
+  }
+
+  Rectangle to_layer(Rectangle r) const
+  {
+    Vector2 a = to_layer(Vector2{r.x, r.y});
+    Vector2 b = to_layer(Vector2{r.x + r.width, r.y + r.height});
+    return {std::min(a.x, b.x), std::min(a.y, b.y), std::abs(b.x - a.x), std::abs(b.y - a.y)};
+  }
+};
+
+// Colors a tile of the heatmap overlay from blue (low) over green to red (high). 'tilemutex' must be held.
+void draw_heatmap_cell(const Layer& layer, const HeatmapCell& cell, Rectangle area)
+{
+  float value, max_value;
+  char text[20];
+
+  if (heatmap == heatmap_mode::accesses) {
+    max_value = (float) layer.heatmap_max_accesses;
+    value = (float) cell.accesses;
+    snprintf(text, sizeof(text), "%u", cell.accesses);
+  }
+  else {
+    if (cell.decodes == 0) {
+      return;
+    }
+
+    max_value = layer.heatmap_max_decode_ms;
+    value = cell.last_decode_ms;
+    snprintf(text, sizeof(text), "%.1f ms", cell.last_decode_ms);
+  }
+
+  float v = value / max_value;
+  Color color{(unsigned char) (255 * std::min(1.0f, 2 * v)),
+              (unsigned char) (255 * (1 - std::abs(2 * v - 1))),
+              (unsigned char) (255 * std::max(0.0f, 1 - 2 * v)),
+              110};
+
+  DrawRectangleRec(area, color);
+  DrawText(text, (int) area.x + 5, (int) area.y + 5, 20, WHITE);
+}
+
+
+// Writes the heatmaps of all layers to CSV files, one file per layer and input file.
+void write_heatmaps()
+{
+  std::lock_guard<std::mutex> lock(tilemutex);
+
+  for (size_t f = 0; f < files.size(); f++) {
+    const HeifFile& file = files[f];
+
+    filemutex.lock();
+    bool has_metadata = file.has_metadata;
+    filemutex.unlock();
+
+    if (!has_metadata) {
+      continue;
+    }
+
+    std::string basename = file.filename.substr(file.filename.find_last_of('/') + 1);
+
+    for (size_t l = 0; l < file.layers.size(); l++) {
+      const Layer& layer = file.layers[l];
+      if (layer.heatmap.empty()) {
+        continue;
+      }
+
+      std::string csv_filename = "heatmap_" + basename + "_layer" + std::to_string(l) + ".csv";
+      std::ofstream ostr(csv_filename);
+      ostr << "tile_x,tile_y,accesses,decodes,last_decode_ms\n";
+
+      for (uint32_t ty = 0; ty < layer.tiling.num_rows; ty++) {
+        for (uint32_t tx = 0; tx < layer.tiling.num_columns; tx++) {
+          const HeatmapCell& cell = layer.heatmap[(size_t) ty * layer.tiling.num_columns + tx];
+          ostr << tx << ',' << ty << ',' << cell.accesses << ',' << cell.decodes << ',' << cell.last_decode_ms << '\n';
+        }
+      }
+
+      printf("wrote %s (render tile size %u x %u)\n", csv_filename.c_str(), layer.tiling.tile_width, layer.tiling.tile_height);
+    }
+  }
+}
+
+void draw_view_statistics(const View& view, const char* label)
+{
+  char text[200];
+  snprintf(text, sizeof(text), "%s: %d tiles, mean %.1f ms/tile, last %.1f ms", label,
+           view.tiles_decoded, view.tiles_decoded ? view.total_decode_ms / view.tiles_decoded : 0.0, view.last_decode_ms);
+
+  DrawRectangle(view.x, 0, MeasureText(text, 20) + 20, 30, {0, 0, 0, 160});
+  DrawText(text, view.x + 10, 5, 20, WHITE);
+}
+
+// Each view may use an equal share of the tile cache.
+size_t view_cache_size()
+{
+  return tile_cache_size / views.size();
+}
+
+// Creates the textures of a decoded tile, as far as the upload budget of the frame allows.
+// At least one part is uploaded in each frame. 'tilemutex' must be held.
+void upload_tile(Tile& tile)
+{
+  if (tile.state != tile_state::waiting_for_texture_upload) {
+    return;
+  }
+
+  for (auto& part : tile.parts) {
+    if (part.uploaded) {
+      continue;
+    }
+
+    int pixels = part.image.width * part.image.height;
+    if (upload_budget > 0 && frame_upload_pixels > 0 && frame_upload_pixels + pixels > upload_budget) {
+      return;
+    }
+
+    if (part.upload_buffer >= 0) {
+      part.texture = upload_tile_part_from_buffer(part);
+    }
+    else {
+      part.texture = LoadTextureFromImage(part.image);
+    }
+    part.uploaded = true;
+
+    frame_upload_pixels += pixels;
+  }
+
+  tile.state = tile_state::ready;
+  keep_cpu_pixels(tile);
+}
+
+// Draws the area 'src' of the texture into 'dst', which is mapped into the window with the orientation of 'placement'.
+// The texture coordinates are rotated and mirrored, so that the tile pixels need not be transformed.
+void draw_oriented_texture(const Texture2D& texture, Rectangle src, Rectangle dst, const OrientedArea& placement)
+{
+  Rectangle window = placement.to_window(dst);
+
+  rlSetTexture(texture.id);
+  rlBegin(RL_QUADS);
+  rlColor4ub(255, 255, 255, 255);
+  rlNormal3f(0, 0, 1);
+
+  // corners in the same winding order as DrawTexturePro(), each with the texture position it shows
+
+  for (Vector2 corner : {Vector2{window.x, window.y},
+                         Vector2{window.x, window.y + window.height},
+                         Vector2{window.x + window.width, window.y + window.height},
+                         Vector2{window.x + window.width, window.y}}) {
+    Vector2 p = placement.to_layer(corner);
+    float u = src.x + (p.x - dst.x) / dst.width * src.width;
+    float v = src.y + (p.y - dst.y) / dst.height * src.height;
+
+    rlTexCoord2f(u / (float) texture.width, v / (float) texture.height);
+    rlVertex2f(corner.x, corner.y);
+  }
+
+  rlEnd();
+  rlSetTexture(0);
+}
+
+// Draws the area 'src' of the tile (in tile pixels) into 'dst' on the screen. Parts that are not uploaded yet are skipped.
+// 'dst' is in the untransformed area of 'placement'.
+void draw_tile_area(const Tile& tile, Rectangle src, Rectangle dst, const OrientedArea& placement = {})
+{
+  float scale_x = dst.width / src.width;
+  float scale_y = dst.height / src.height;
+
+  for (const auto& part : tile.parts) {
+    if (!part.uploaded) {
+      continue;
+    }
+
+    float x0 = std::max(src.x, (float) part.x), x1 = std::min(src.x + src.width, (float) (part.x + part.texture.width));
+    float y0 = std::max(src.y, (float) part.y), y1 = std::min(src.y + src.height, (float) (part.y + part.texture.height));
+    if (x0 >= x1 || y0 >= y1) {
+      continue;
+    }
+
+    Rectangle part_src{x0 - (float) part.x, y0 - (float) part.y, x1 - x0, y1 - y0};
+    Rectangle part_dst{dst.x + (x0 - src.x) * scale_x, dst.y + (y0 - src.y) * scale_y, (x1 - x0) * scale_x, (y1 - y0) * scale_y};
+
+    if (placement.orientation.is_identity()) {
+      DrawTexturePro(part.texture, part_src, part_dst, {0, 0}, 0, WHITE);
+    }
+    else {
+      draw_oriented_texture(part.texture, part_src, part_dst, placement);
+    }
+  }
+}
+
+// Frees the textures and pixel buffers of the tile. 'tilemutex' must be held.
+void free_tile_parts(Tile& tile)
+{
+  release_cpu_pixels(tile);
+
+  for (auto& part : tile.parts) {
+    if (part.uploaded) {
+      UnloadTexture(part.texture);
+      if (part.image.data) {
+        release_pixel_buffer(part.image); // kept pixels of a tile whose upload has not finished yet
+      }
+    }
+    else {
+      release_tile_part_pixels(part);
+    }
+  }
+
+  tile.parts.clear();
+}
+
+// Speculative tiles may only use this share of the cache of a view.
+size_t max_speculative_tiles()
+{
+  return std::max((size_t) 1, view_cache_size() / 4);
+}
+
+// Counts the tiles of a view per cache class. 'tilemutex' must be held.
+void count_cache_classes(uint32_t view_idx, size_t counts[num_cache_classes])
+{
+  std::fill(counts, counts + num_cache_classes, 0);
+
+  for (const auto& tile : tiles) {
+    if (files[tile.key.file].view == view_idx) {
+      counts[(int) get_cache_class(tile)]++;
+    }
+  }
+}
+
+// Removes a tile from the view's cache: a tile of the lowest priority class, or of the speculative class only.
+// Speculative tiles are removed in LRU order, the other classes in the order of the view's replacement policy.
+// Pinned tiles are never removed. 'tilemutex' must be held.
+void evict_tile(uint32_t view_idx, bool speculative_only = false)
+{
+  const int eviction_rank[num_cache_classes] = {-1, 2, 1, 0}; // indexed by cache_class
+
+  // --- find the lowest class and its least recently used tile
+
+  size_t victim = tiles.size();
+  for (size_t i = 0; i < tiles.size(); i++) {
+    const Tile& tile = tiles[i];
+    cache_class cls = get_cache_class(tile);
+
+    if (files[tile.key.file].view != view_idx || cls == cache_class::pinned ||
+        (speculative_only && cls != cache_class::speculative)) {
+      continue;
+    }
+
+    if (victim == tiles.size()) {
+      victim = i;
+      continue;
+    }
+
+    int rank = eviction_rank[(int) cls];
+    int victim_rank = eviction_rank[(int) get_cache_class(tiles[victim])];
+    if (rank < victim_rank || (rank == victim_rank && tile.last_used_frame < tiles[victim].last_used_frame)) {
+      victim = i;
+    }
+  }
+
+  if (victim == tiles.size()) {
+    return;
+  }
+
+  // --- let the policy choose among the tiles of that class
+
+  cache_class victim_class = get_cache_class(tiles[victim]);
+  CachePolicy& policy = *cache_policies[view_idx];
+
+  if (victim_class != cache_class::speculative) {
+    std::unordered_map<uint64_t, size_t> candidates;
+    for (size_t i = 0; i < tiles.size(); i++) {
+      if (files[tiles[i].key.file].view == view_idx && get_cache_class(tiles[i]) == victim_class) {
+        candidates[tile_id(tiles[i].key)] = i;
+      }
+    }
+
+    uint64_t id;
+    if (policy.select_victim([&](uint64_t candidate) { return candidates.count(candidate) > 0; }, id)) {
+      victim = candidates[id];
+    }
+
+    policy.evict(tile_id(tiles[victim].key));
+  }
+
+  Tile& tile = tiles[victim];
+  free_tile_parts(tile);
+
+  cache_evictions[(int) victim_class]++;
+
+  tiles[victim] = std::move(tiles.back());
+  tiles.pop_back();
+}
+
+// Adds a tile to the cache and requests its decoding. Prefetched tiles are added as speculative tiles.
+// Pinned tiles do not count against the cache size. 'tilemutex' must be held.
+void add_tile_to_cache(const TileKey& key, request_priority priority, bool pinned = false)
+{
+  uint32_t view = files[key.file].view;
+
+  cache_class cls = pinned ? cache_class::pinned :
+                    (priority == request_priority::prefetch) ? cache_class::speculative : cache_class::visible;
+
+  size_t counts[num_cache_classes];
+  count_cache_classes(view, counts);
+
+  size_t tiles_in_view = counts[(int) cache_class::visible] + counts[(int) cache_class::recent] + counts[(int) cache_class::speculative];
+
+  if (cls == cache_class::speculative && counts[(int) cache_class::speculative] >= max_speculative_tiles()) {
+    evict_tile(view, true);
+  }
+  else if (cls != cache_class::pinned && tiles_in_view >= view_cache_size()) {
+    evict_tile(view);
+  }
+
+  Tile t;
+  t.key = key;
+  t.cls = cls;
+  t.last_used_frame = frame_nr;
+  tiles.push_back(t);
+
+  if (cls == cache_class::visible) {
+    cache_policies[view]->insert(tile_id(key));
+  }
+
+  request_tile(key, priority);
+}
+
+// 'tilemutex' must be held
+void print_cache_statistics()
+{
+  for (uint32_t v = 0; v < views.size(); v++) {
+    size_t counts[num_cache_classes];
+    count_cache_classes(v, counts);
+
+    if (views.size() > 1) {
+      printf("tile cache of view %u:", v);
+    }
+    else {
+      printf("tile cache:");
+    }
+
+    for (int c = 0; c < num_cache_classes; c++) {
+      printf(" %s %zu", cache_class_names[c], counts[c]);
+    }
+    printf("\n");
+  }
+
+  printf("evictions:");
+  for (int c = 1; c < num_cache_classes; c++) {
+    printf(" %s %" PRIu64, cache_class_names[c], cache_evictions[c]);
+  }
+  printf("\n");
+
+  printf("cache policy %s: %" PRIu64 " tiles came into view, hit rate %.1f%%\n", cache_policies[0]->name(),
+         cache_lookups, cache_lookups ? 100.0 * (double) cache_hits / (double) cache_lookups : 0.0);
+}
+
+
+// Range of tiles of a file that is visible in its view, with the window at canvas position (x0,y0) of zoom level 'shift'
+struct VisibleTiles
+{
+  int layer;
+  int fx0, fy0;           // window position of the file's top left corner
+  int tx0, ty0, tx1, ty1; // visible tile columns [tx0;tx1) and rows [ty0;ty1)
+  OrientedArea placement; // for drawing the tiles, which are positioned at (fx0,fy0) + tile size * (tx,ty)
+};
+
+// The file's metadata must be known. Returns false if no tile is visible.
+bool get_visible_tiles(const HeifFile& file, uint32_t shift, int x0, int y0, VisibleTiles& visible)
+{
+  const View& view = views[file.view];
+
+  visible.layer = file_layer(file, shift);
+  if (visible.layer < 0) {
+    return false;
+  }
+
+  const heif_image_tiling& tiling = file.layers[visible.layer].tiling;
+  int tile_width = (int) tiling.tile_width; // Tile size in signed integer (for computing with negative coordinates)
+  int tile_height = (int) tiling.tile_height;
+
+  int scale = 1 << shift;
+  visible.fx0 = view.x + floor_div(file.offset_x, scale) - x0;
+  visible.fy0 = floor_div(file.offset_y, scale) - y0;
+
+  visible.placement.orientation = file.layers[visible.layer].orientation;
+  visible.placement.area = {(float) visible.fx0, (float) visible.fy0, (float) tiling.image_width, (float) tiling.image_height};
+
+  // view area in the untransformed layer
+  Rectangle area = visible.placement.to_layer(Rectangle{(float) view.x, 0, (float) view.width, (float) window_height});
+  int ax0 = (int) std::floor(area.x), ay0 = (int) std::floor(area.y);
+  int ax1 = (int) std::ceil(area.x + area.width), ay1 = (int) std::ceil(area.y + area.height);
+
+  visible.tx0 = std::max(0, floor_div(ax0 - visible.fx0, tile_width));
+  visible.ty0 = std::max(0, floor_div(ay0 - visible.fy0, tile_height));
+  visible.tx1 = std::min((int) tiling.num_columns, floor_div(ax1 - visible.fx0 + tile_width - 1, tile_width));
+  visible.ty1 = std::min((int) tiling.num_rows, floor_div(ay1 - visible.fy0 + tile_height - 1, tile_height));
+
+  return visible.tx0 < visible.tx1 && visible.ty0 < visible.ty1;
+}
+
+
+// --- Order in which missing tiles are requested. Raster order fills the center of the view, where the user is looking, last.
+
+enum class request_order
+{
+  raster,  // row by row from the top left
+  spiral,  // from the center of the view outwards
+  hilbert  // along a Hilbert curve through the layer, for locality of the decoded tiles
+};
+
+request_order tile_request_order = request_order::spiral;
+
+// Position of (x,y) on the Hilbert curve through an n x n grid, n a power of two
+uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y)
+{
+  uint64_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) ? 1 : 0;
+    uint32_t ry = (y & s) ? 1 : 0;
+    d += (uint64_t) s * s * ((3 * rx) ^ ry);
+
+    // rotate the quadrant
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+
+  return d;
+}
+
+// Returns the visible tiles (tx,ty) in the order in which they are requested
+std::vector<std::pair<int, int>> order_visible_tiles(const HeifFile& file, const VisibleTiles& visible)
+{
+  std::vector<std::pair<int, int>> order;
+  for (int ty = visible.ty0; ty < visible.ty1; ty++) {
+    for (int tx = visible.tx0; tx < visible.tx1; tx++) {
+      order.emplace_back(tx, ty);
+    }
+  }
+
+  if (tile_request_order == request_order::raster) {
+    return order;
+  }
+
+  const heif_image_tiling& tiling = file.layers[visible.layer].tiling;
+  std::vector<std::pair<double, size_t>> sort_keys(order.size()); // (sort key, index into 'order')
+
+  if (tile_request_order == request_order::spiral) {
+    const View& view = views[file.view];
+    Vector2 center = visible.placement.to_layer(Vector2{(float) view.x + (float) view.width / 2, (float) window_height / 2});
+    double cx = center.x;
+    double cy = center.y;
+
+    for (size_t i = 0; i < order.size(); i++) {
+      double dx = visible.fx0 + (order[i].first + 0.5) * tiling.tile_width - cx;
+      double dy = visible.fy0 + (order[i].second + 0.5) * tiling.tile_height - cy;
+
+      // rings of increasing distance, each sorted by angle
+      double ring = std::floor(std::hypot(dx, dy) / std::max(tiling.tile_width, tiling.tile_height));
+      sort_keys[i] = {ring * 8 + std::atan2(dy, dx), i};
+    }
+  }
+  else {
+    uint32_t n = 1;
+    while (n < tiling.num_columns || n < tiling.num_rows) {
+      n *= 2;
+    }
+
+    for (size_t i = 0; i < order.size(); i++) {
+      sort_keys[i] = {(double) hilbert_index(n, order[i].first, order[i].second), i};
+    }
+  }
+
+  std::sort(sort_keys.begin(), sort_keys.end());
+
+  std::vector<std::pair<int, int>> sorted;
+  for (const auto& key : sort_keys) {
+    sorted.push_back(order[key.second]);
+  }
+
+  return sorted;
+}
+
+
+// Requests the tiles of a layer that is 'levels' layers coarser than the one visible at zoom level 'shift', covering the same area.
+// These are decoded quickly and can be shown scaled up as placeholders until the visible tiles are available. 'tilemutex' must be held.
+void request_placeholder_tiles(uint32_t shift, int x0, int y0, int levels);
+
+// Checks whether the file is visible in its view and opens it if it is visible for the first time.
+// Returns true if the file is visible and its metadata is known.
+bool check_file_visibility(uint32_t file_idx, uint32_t shift, int x0, int y0, bool draw_outline)
+{
+  HeifFile& file = files[file_idx];
+  const View& view = views[file.view];
+
+  std::lock_guard<std::mutex> lock(filemutex);
+
+  if (file.width == 0 && !file.has_metadata) {
+    // size unknown: the file is opened at startup and this cannot happen
+    return false;
+  }
+
+  int scale = 1 << shift;
+  int fx0 = view.x + floor_div(file.offset_x, scale) - x0;
+  int fy0 = floor_div(file.offset_y, scale) - y0;
+  int w = (int) ((file.width + scale - 1) >> shift);
+  int h = (int) ((file.height + scale - 1) >> shift);
+
+  if (fx0 >= view.x + view.width || fy0 >= window_height || fx0 + w <= view.x || fy0 + h <= 0) {
+    return false;
+  }
+
+  file.last_used = ++file_use_counter;
+
+  // --- open files that became visible for the first time
+
+  if (!file.has_metadata) {
+    if (!file.open_requested) {
+      file.open_requested = true;
+      request_file_open(file_idx);
+    }
+
+    if (draw_outline) {
+      DrawRectangleLines(fx0, fy0, w, h, GRAY);
+      visible_tiles_pending++;
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+
+// Draws the area of a tile that is not decoded yet, scaled up from the nearest coarser layer in the cache. 'tilemutex' must be held.
+void draw_placeholder(uint32_t file_idx, int layer_idx, int tx, int ty, int px, int py, const OrientedArea& placement)
+{
+  const HeifFile& file = files[file_idx];
+  const heif_image_tiling& tiling = file.layers[layer_idx].tiling;
+
+  for (int coarse_idx = layer_idx - 1; coarse_idx >= 0; coarse_idx--) {
+    const heif_image_tiling& coarse = file.layers[coarse_idx].tiling;
+    float scale = (float) (1 << (layer_idx - coarse_idx));
+
+    // area of the tile in the coarse layer
+
+    float x0 = (float) (tx * tiling.tile_width) / scale;
+    float y0 = (float) (ty * tiling.tile_height) / scale;
+    float x1 = (float) ((tx + 1) * tiling.tile_width) / scale;
+    float y1 = (float) ((ty + 1) * tiling.tile_height) / scale;
+
+    int ctx0 = (int) (x0 / coarse.tile_width), ctx1 = (int) std::ceil(x1 / coarse.tile_width);
+    int cty0 = (int) (y0 / coarse.tile_height), cty1 = (int) std::ceil(y1 / coarse.tile_height);
+    ctx1 = std::min(ctx1, (int) coarse.num_columns);
+    cty1 = std::min(cty1, (int) coarse.num_rows);
+
+    // all covering tiles have to be in the cache
+
+    std::vector<Tile*> coarse_tiles;
+    for (int cty = cty0; cty < cty1; cty++) {
+      for (int ctx = ctx0; ctx < ctx1; ctx++) {
+        Tile* tile = find_tile({file_idx, (uint32_t) coarse_idx, ctx, cty});
+        if (tile && tile->state != tile_state::loading) {
+          upload_tile(*tile);
+          coarse_tiles.push_back(tile);
+        }
+      }
+    }
+
+    if (coarse_tiles.empty() || coarse_tiles.size() != (size_t) ((ctx1 - ctx0) * (cty1 - cty0))) {
+      continue;
+    }
+
+    for (Tile* tile : coarse_tiles) {
+      touch_tile(*tile);
+
+      float tile_x0 = (float) (tile->key.x * coarse.tile_width);
+      float tile_y0 = (float) (tile->key.y * coarse.tile_height);
+
+      float ix0 = std::max(x0, tile_x0), ix1 = std::min(x1, tile_x0 + (float) coarse.tile_width);
+      float iy0 = std::max(y0, tile_y0), iy1 = std::min(y1, tile_y0 + (float) coarse.tile_height);
+
+      Rectangle src{ix0 - tile_x0, iy0 - tile_y0, ix1 - ix0, iy1 - iy0};
+      Rectangle dst{(float) px + (ix0 - x0) * scale, (float) py + (iy0 - y0) * scale, (ix1 - ix0) * scale, (iy1 - iy0) * scale};
+      draw_tile_area(*tile, src, dst, placement);
+    }
+
+    return;
+  }
+}
+
+
+// Draws the visible tiles of one file into its view and requests missing tiles. 'tilemutex' must be held.
+void draw_file(uint32_t file_idx, int x0, int y0)
+{
+  HeifFile& file = files[file_idx];
+
+  // --- skip files outside of the window
+
+  if (!check_file_visibility(file_idx, zoom_shift, x0, y0, true)) {
+    return;
+  }
+
+  VisibleTiles visible;
+  if (!get_visible_tiles(file, zoom_shift, x0, y0, visible)) {
+    return;
+  }
+
+  Layer& layer = file.layers[visible.layer];
+  int tile_width = (int) layer.tiling.tile_width;
+  int tile_height = (int) layer.tiling.tile_height;
+
+  // Outlines and heatmap are drawn after the tiles, without the tone adjustments.
+  std::vector<std::pair<Rectangle, const HeatmapCell*>> overlays;
+
+  begin_tile_shader(file);
+
+  for (auto [tx, ty] : order_visible_tiles(file, visible)) {
+    int px = visible.fx0 + tx * tile_width;
+    int py = visible.fy0 + ty * tile_height;
+
+    TileKey key{file_idx, (uint32_t) visible.layer, tx, ty};
+    bool tile_found = false;
+
+    Rectangle src{0, 0, (float) tile_width, (float) tile_height};
+    Rectangle dst{(float) px, (float) py, (float) tile_width, (float) tile_height};
+
+    if (Tile* tile = find_tile(key)) {
+      tile_found = true;
+      touch_tile(*tile);
+      upload_tile(*tile);
+
+      if (tile->state == tile_state::ready) {
+        draw_tile_area(*tile, src, dst, visible.placement);
+      }
+      else {
+        // Parts of a large tile that are uploaded already are drawn over the placeholder.
+        draw_placeholder(file_idx, visible.layer, tx, ty, px, py, visible.placement);
+        draw_tile_area(*tile, src, dst, visible.placement);
+        promote_tile_request(key);
+        visible_tiles_pending++;
+      }
+    }
+
+    Rectangle outline = visible.placement.to_window(dst);
+
+    // --- Count how often the tile comes into view
+
+    HeatmapCell& cell = layer.heatmap_cell(tx, ty);
+    if (cell.last_visible_frame + 1 < frame_nr || cell.accesses == 0) {
+      cell.accesses++;
+      layer.heatmap_max_accesses = std::max(layer.heatmap_max_accesses, cell.accesses);
+
+      cache_lookups++;
+      if (tile_found) {
+        cache_hits++;
+      }
+    }
+    cell.last_visible_frame = frame_nr;
+
+    overlays.emplace_back(outline, &cell);
+
+    // --- If the tile is not loaded yet, load it in the background
+
+    if (!tile_found) {
+      draw_placeholder(file_idx, visible.layer, tx, ty, px, py, visible.placement);
+      add_tile_to_cache(key, request_priority::visible);
+      visible_tiles_pending++;
+    }
+  }
+
+  end_tile_shader();
+
+  for (const auto& [outline, cell] : overlays) {
+    DrawRectangleLines((int) outline.x, (int) outline.y, (int) outline.width, (int) outline.height, WHITE);
+
+    if (heatmap != heatmap_mode::off) {
+      draw_heatmap_cell(layer, *cell, outline);
+    }
+  }
+}
+
+
+// Requests the tiles of a file that are visible with the window at canvas position (x0,y0) of zoom level 'shift'.
+// Returns the number of new requests. 'tilemutex' must be held.
+int request_file_tiles(uint32_t file_idx, uint32_t shift, int x0, int y0, request_priority priority, bool pinned)
+{
+  const HeifFile& file = files[file_idx];
+
+  if (!check_file_visibility(file_idx, shift, x0, y0, false)) {
+    return 0;
+  }
+
+  VisibleTiles visible;
+  if (!get_visible_tiles(file, shift, x0, y0, visible)) {
+    return 0;
+  }
+
+  int num_requests = 0;
+
+  // The prefetch queue is processed newest first. Adding its tiles in reverse order decodes them in request order.
+
+  auto order = order_visible_tiles(file, visible);
+  if (priority == request_priority::prefetch) {
+    std::reverse(order.begin(), order.end());
+  }
+
+  for (auto [tx, ty] : order) {
+    TileKey key{file_idx, (uint32_t) visible.layer, tx, ty};
+    if (Tile* tile = find_tile(key)) {
+      if (pinned) {
+        pin_tile(*tile);
+      }
+    }
+    else {
+      add_tile_to_cache(key, priority, pinned);
+      num_requests++;
+    }
+  }
+
+  return num_requests;
+}
+
+void request_placeholder_tiles(uint32_t shift, int x0, int y0, int levels)
+{
+  for (uint32_t i = 0; i < files.size(); i++) {
+    const HeifFile& file = files[i];
+
+    VisibleTiles visible;
+    if (!check_file_visibility(i, shift, x0, y0, false) || !get_visible_tiles(file, shift, x0, y0, visible)) {
+      continue;
+    }
+
+    int coarse_layer = std::max(0, visible.layer - levels);
+    if (coarse_layer == visible.layer) {
+      continue;
+    }
+
+    const heif_image_tiling& tiling = file.layers[visible.layer].tiling;
+    const heif_image_tiling& coarse = file.layers[coarse_layer].tiling;
+    int scale = 1 << (visible.layer - coarse_layer);
+
+    int ctx0 = visible.tx0 * (int) tiling.tile_width / scale / (int) coarse.tile_width;
+    int cty0 = visible.ty0 * (int) tiling.tile_height / scale / (int) coarse.tile_height;
+    int ctx1 = std::min((int) coarse.num_columns, (visible.tx1 * (int) tiling.tile_width / scale + (int) coarse.tile_width - 1) / (int) coarse.tile_width);
+    int cty1 = std::min((int) coarse.num_rows, (visible.ty1 * (int) tiling.tile_height / scale + (int) coarse.tile_height - 1) / (int) coarse.tile_height);
+
+    for (int ty = cty0; ty < cty1; ty++) {
+      for (int tx = ctx0; tx < ctx1; tx++) {
+        TileKey key{i, (uint32_t) coarse_layer, tx, ty};
+        if (!find_tile(key)) {
+          add_tile_to_cache(key, request_priority::visible);
+        }
+      }
+    }
+  }
+}
+
+int request_tiles(uint32_t shift, int x0, int y0, request_priority priority, bool pinned = false)
+{
+  int num_requests = 0;
+  for (uint32_t i = 0; i < files.size(); i++) {
+    num_requests += request_file_tiles(i, shift, x0, y0, priority, pinned);
+  }
+
+  return num_requests;
+}
+
+
+// --- Minimap, drawn from the coarsest layer of each file. Its tiles are pinned in the cache.
+
+bool show_minimap = true;
+const int minimap_max_size = 256;
+const uint32_t minimap_max_tiles_per_file = 16; // images without a small pyramid layer are only shown as outlines
+
+struct Minimap
+{
+  Rectangle area;       // window area
+  int canvas_x0, canvas_y0; // top left corner of the bounding box of all files, in full resolution pixels
+  float scale;          // minimap pixels per full resolution pixel
+};
+
+// Computes the minimap area from the bounding box of all files with known size. Returns false if there is none.
+bool get_minimap(Minimap& minimap)
+{
+  std::lock_guard<std::mutex> lock(filemutex);
+
+  int x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+  for (const auto& file : files) {
+    if (file.width > 0 && file.view == 0) {
+      x0 = std::min(x0, file.offset_x);
+      y0 = std::min(y0, file.offset_y);
+      x1 = std::max(x1, file.offset_x + (int) file.width);
+      y1 = std::max(y1, file.offset_y + (int) file.height);
+    }
+  }
+
+  if (x0 >= x1 || y0 >= y1) {
+    return false;
+  }
+
+  minimap.canvas_x0 = x0;
+  minimap.canvas_y0 = y0;
+  minimap.scale = std::min(minimap_max_size / (float) (x1 - x0), minimap_max_size / (float) (y1 - y0));
+  minimap.area.width = (float) (x1 - x0) * minimap.scale;
+  minimap.area.height = (float) (y1 - y0) * minimap.scale;
+  minimap.area.x = (float) window_width - minimap.area.width - 10;
+  minimap.area.y = 10;
+
+  return true;
+}
+
+// Requests all tiles of the coarsest layer of every file with known metadata once. 'tilemutex' must be held.
+void request_minimap_tiles()
+{
+  for (uint32_t i = 0; i < files.size(); i++) {
+    HeifFile& file = files[i];
+
+    filemutex.lock();
+    bool has_metadata = file.has_metadata;
+    filemutex.unlock();
+
+    if (!has_metadata || file.minimap_requested || file.view != 0) {
+      continue;
+    }
+
+    file.minimap_requested = true;
+
+    const heif_image_tiling& tiling = file.layers[0].tiling;
+    if (tiling.num_columns * tiling.num_rows > minimap_max_tiles_per_file) {
+      continue;
+    }
+
+    file.minimap_tiles = true;
+
+    for (uint32_t ty = 0; ty < tiling.num_rows; ty++) {
+      for (uint32_t tx = 0; tx < tiling.num_columns; tx++) {
+        TileKey key{i, 0, (int) tx, (int) ty};
+        if (Tile* tile = find_tile(key)) {
+          pin_tile(*tile);
+        }
+        else {
+          add_tile_to_cache(key, request_priority::visible, true);
+        }
+      }
+    }
+  }
+}
+
+// Requests the tiles of the coarsest layer of every file with known metadata that have not been counted yet, for the auto-levels.
+// They are pinned until they are counted, so that they are neither dropped from the prefetch queue nor evicted. Called in every frame until all
+// tiles have been counted. 'tilemutex' must be held.
+void request_histogram_tiles()
+{
+  for (uint32_t i = 0; i < files.size(); i++) {
+    HeifFile& file = files[i];
+
+    filemutex.lock();
+    bool has_metadata = file.has_metadata;
+    filemutex.unlock();
+
+    if (!has_metadata || file.histogram_complete) {
+      continue;
+    }
+
+    const Layer& layer = file.layers[0];
+    const heif_image_tiling& tiling = layer.tiling;
+    if (tiling.num_columns * tiling.num_rows > histogram_max_coarse_tiles) {
+      file.histogram_complete = true;
+      continue;
+    }
+
+    bool complete = true;
+
+    for (uint32_t ty = 0; ty < tiling.num_rows; ty++) {
+      for (uint32_t tx = 0; tx < tiling.num_columns; tx++) {
+        if (!layer.histogram_tiles.empty() && layer.histogram_tiles[ty * tiling.num_columns + tx]) {
+          continue;
+        }
+
+        complete = false;
+
+        // Tiles decoded before the histograms were counted are decoded again
+
+        TileKey key{i, 0, (int) tx, (int) ty};
+        if (Tile* tile = find_tile(key)) {
+          if (tile->cls != cache_class::pinned) {
+            pin_tile(*tile);
+            tile->histogram_pin = true;
+          }
+
+          if (tile->state == tile_state::ready) {
+            request_tile_pixels(*tile);
+          }
+        }
+        else {
+          add_tile_to_cache(key, request_priority::visible, true);
+          find_tile(key)->histogram_pin = true;
+        }
+      }
+    }
+
+    file.histogram_complete = complete;
+  }
+}
+
+// Draws the minimap with the area of the first view at window position (x0,y0). 'tilemutex' must be held.
+void draw_minimap(const Minimap& minimap, int x0, int y0)
+{
+  DrawRectangleRec(minimap.area, {0, 0, 0, 200});
+
+  std::unique_lock<std::mutex> lock(filemutex);
+
+  for (uint32_t i = 0; i < files.size(); i++) {
+    HeifFile& file = files[i];
+    if (file.view != 0 || file.width == 0) {
+      continue;
+    }
+
+    float fx = minimap.area.x + (float) (file.offset_x - minimap.canvas_x0) * minimap.scale;
+    float fy = minimap.area.y + (float) (file.offset_y - minimap.canvas_y0) * minimap.scale;
+
+    if (file.minimap_tiles) {
+      const heif_image_tiling& tiling = file.layers[0].tiling;
+      float layer_scale = minimap.scale * (float) (1 << (file.layers.size() - 1)); // minimap pixels per coarse layer pixel
+
+      OrientedArea placement;
+      placement.orientation = file.layers[0].orientation;
+      placement.area = {fx, fy, (float) tiling.image_width * layer_scale, (float) tiling.image_height * layer_scale};
+
+      begin_tile_shader(file);
+
+      for (uint32_t ty = 0; ty < tiling.num_rows; ty++) {
+        for (uint32_t tx = 0; tx < tiling.num_columns; tx++) {
+          Tile* tile = find_tile({i, 0, (int) tx, (int) ty});
+          if (!tile) {
+            continue;
+          }
+
+          upload_tile(*tile);
+
+          Rectangle src{0, 0, (float) tiling.tile_width, (float) tiling.tile_height};
+          Rectangle dst{fx + (float) (tx * tiling.tile_width) * layer_scale, fy + (float) (ty * tiling.tile_height) * layer_scale,
+                        (float) tiling.tile_width * layer_scale, (float) tiling.tile_height * layer_scale};
+          draw_tile_area(*tile, src, dst, placement);
+        }
+      }
+
+      end_tile_shader();
+    }
+
+    DrawRectangleLines((int) fx, (int) fy, (int) ((float) file.width * minimap.scale), (int) ((float) file.height * minimap.scale), DARKGRAY);
+  }
+
+  lock.unlock();
+
+  // --- area of the first view
+
+  float scale = minimap.scale * (float) (1 << zoom_shift);
+  Rectangle view_area{minimap.area.x + ((float) x0 * scale - (float) minimap.canvas_x0 * minimap.scale),
+                      minimap.area.y + ((float) y0 * scale - (float) minimap.canvas_y0 * minimap.scale),
+                      (float) views[0].width * scale, (float) window_height * scale};
+
+  BeginScissorMode((int) minimap.area.x, (int) minimap.area.y, (int) minimap.area.width, (int) minimap.area.height);
+  DrawRectangleLinesEx(view_area, 2, RED);
+  EndScissorMode();
+
+  DrawRectangleLinesEx(minimap.area, 1, WHITE);
+}
+
+
+// --- Statistics of a rectangle at full resolution. The tiles that intersect the rectangle are streamed through the
+//     decoding pool with the lowest priority. Only 'region_max_tiles_in_flight' tiles are queued or being decoded at
+//     a time, so the memory does not depend on the size of the region. Tiles whose pixels are still in memory are not decoded again.
+
+struct RegionStats
+{
+  bool active = false;   // tiles are being counted
+  bool finished = false; // 'histogram' is complete
+  uint32_t generation = 0; // results of requests of an earlier region are dropped
+
+  uint32_t view = 0;
+  int x0 = 0, y0 = 0, x1 = 0, y1 = 0; // region on the canvas, in full resolution pixels
+
+  std::vector<uint32_t> files_to_plan; // intersecting files whose metadata is not known yet
+  std::vector<TileKey> tiles;          // intersecting tiles of the full resolution layers
+  size_t next_tile = 0;
+  size_t tiles_done = 0;
+
+  Histogram histogram;
+  std::chrono::steady_clock::time_point start_time;
+};
+
+RegionStats region;
+std::mutex region_mutex; // lock order: region_mutex -> decode_queue_mutex
+
+size_t region_max_tiles_in_flight()
+{
+  return 2 * (size_t) num_decode_threads;
+}
+
+// Area of the region in the full resolution layer of the file, in the orientation of its tiles.
+// 'region_mutex' must be held and the file's metadata must be known.
+Rectangle region_in_file(const HeifFile& file)
+{
+  const Layer& layer = file.layers.back();
+
+  Rectangle area{(float) (region.x0 - file.offset_x), (float) (region.y0 - file.offset_y),
+                 (float) (region.x1 - region.x0), (float) (region.y1 - region.y0)};
+
+  if (!layer.orientation.is_identity()) {
+    OrientedArea placement{layer.orientation, {0, 0, (float) layer.tiling.image_width, (float) layer.tiling.image_height}};
+    area = placement.to_layer(area);
+  }
+
+  float x0 = std::max(area.x, 0.0f), x1 = std::min(area.x + area.width, (float) layer.tiling.image_width);
+  float y0 = std::max(area.y, 0.0f), y1 = std::min(area.y + area.height, (float) layer.tiling.image_height);
+  return {x0, y0, std::max(0.0f, x1 - x0), std::max(0.0f, y1 - y0)};
+}
+
+// Adds the tiles of the file's full resolution layer that intersect the region. 'region_mutex' must be held.
+void plan_region_file(uint32_t file_idx)
+{
+  const HeifFile& file = files[file_idx];
+  const heif_image_tiling& tiling = file.layers.back().tiling;
+
+  Rectangle area = region_in_file(file);
+  if (area.width <= 0 || area.height <= 0) {
+    return;
+  }
+
+  int tx0 = (int) area.x / (int) tiling.tile_width, tx1 = ((int) (area.x + area.width) - 1) / (int) tiling.tile_width;
+  int ty0 = (int) area.y / (int) tiling.tile_height, ty1 = ((int) (area.y + area.height) - 1) / (int) tiling.tile_height;
+
+  for (int ty = ty0; ty <= ty1; ty++) {
+    for (int tx = tx0; tx <= tx1; tx++) {
+      region.tiles.push_back({file_idx, (uint32_t) file.layers.size() - 1, tx, ty});
+    }
+  }
+}
+
+// Queues the next tiles up to the limit of tiles in flight. 'region_mutex' must be held.
+void queue_region_tiles()
+{
+  decode_queue_mutex.lock();
+
+  while (region.next_tile < region.tiles.size() && region.next_tile - region.tiles_done < region_max_tiles_in_flight()) {
+    DecodeRequest request{DecodeRequest::type::region_tile, region.tiles[region.next_tile++]};
+    request.generation = region.generation;
+    region_queue.push_back(request);
+  }
+
+  decode_queue_mutex.unlock();
+
+  decode_queue_cond.notify_all();
+}
+
+// Starts counting the region (x0,y0)-(x1,y1) of the canvas in the files of the view. A running count is dropped.
+void start_region_stats(uint32_t view, int x0, int y0, int x1, int y1)
+{
+  std::vector<bool> has_metadata(files.size());
+  {
+    std::lock_guard<std::mutex> lock(filemutex);
+    for (size_t i = 0; i < files.size(); i++) {
+      has_metadata[i] = files[i].has_metadata;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(region_mutex);
+
+  region.generation++;
+  region.active = true;
+  region.finished = false;
+  region.view = view;
+  region.x0 = std::min(x0, x1);
+  region.y0 = std::min(y0, y1);
+  region.x1 = std::max(x0, x1);
+  region.y1 = std::max(y0, y1);
+  region.files_to_plan.clear();
+  region.tiles.clear();
+  region.next_tile = 0;
+  region.tiles_done = 0;
+  region.histogram = Histogram();
+  region.start_time = std::chrono::steady_clock::now();
+
+  {
+    std::lock_guard<std::mutex> queue_lock(decode_queue_mutex);
+    region_queue.clear();
+  }
+
+  for (uint32_t i = 0; i < files.size(); i++) {
+    const HeifFile& file = files[i];
+    if (file.view != view) {
+      continue;
+    }
+
+    if (file.offset_x >= region.x1 || file.offset_y >= region.y1 ||
+        file.offset_x + (int) file.width <= region.x0 || file.offset_y + (int) file.height <= region.y0) {
+      continue;
+    }
+
+    if (has_metadata[i]) {
+      plan_region_file(i);
+    }
+    else {
+      region.files_to_plan.push_back(i);
+    }
+  }
+
+  queue_region_tiles();
+}
+
+// Counts the pixels of the tile inside of the region. 'area' is in tile pixels.
+void count_tile_area(const Color* pixels, int stride, Rectangle area, Histogram& histogram)
+{
+  count_histogram(pixels + (size_t) area.y * stride + (size_t) area.x, stride, (int) area.width, (int) area.height, histogram);
+}
+
+// Counts the area of the tile from its pixels if they are still in memory. 'tilemutex' must be held.
+bool count_cached_tile(const TileKey& key, Rectangle area, Histogram& histogram)
+{
+  const Tile* tile = find_tile(key);
+  if (!tile || tile->state == tile_state::loading) {
+    return false;
+  }
+
+  for (const auto& part : tile->parts) {
+    if (!part.image.data) {
+      return false;
+    }
+  }
+
+  for (const auto& part : tile->parts) {
+    float x0 = std::max(area.x, (float) part.x), x1 = std::min(area.x + area.width, (float) (part.x + part.image.width));
+    float y0 = std::max(area.y, (float) part.y), y1 = std::min(area.y + area.height, (float) (part.y + part.image.height));
+    if (x0 < x1 && y0 < y1) {
+      count_tile_area((const Color*) part.image.data, part.image.width,
+                      {x0 - (float) part.x, y0 - (float) part.y, x1 - x0, y1 - y0}, histogram);
+    }
+  }
+
+  return true;
+}
+
+// Called on a decoding thread for each tile of the region
+void count_region_tile(const DecodeRequest& request, heif_decoding_options* options)
+{
+  const TileKey& key = request.key;
+  HeifFile& file = files[key.file];
+
+  Rectangle area;
+  {
+    std::lock_guard<std::mutex> lock(region_mutex);
+    if (request.generation != region.generation) {
+      return;
+    }
+
+    const heif_image_tiling& tiling = file.layers[key.layer].tiling;
+    Rectangle file_area = region_in_file(file);
+    float tile_x0 = (float) (key.x * (int) tiling.tile_width), tile_y0 = (float) (key.y * (int) tiling.tile_height);
+
+    float x0 = std::max(file_area.x, tile_x0), x1 = std::min(file_area.x + file_area.width, tile_x0 + (float) tiling.tile_width);
+    float y0 = std::max(file_area.y, tile_y0), y1 = std::min(file_area.y + file_area.height, tile_y0 + (float) tiling.tile_height);
+    area = {x0 - tile_x0, y0 - tile_y0, x1 - x0, y1 - y0};
+  }
+
+  Histogram histogram;
+
+  tilemutex.lock();
+  bool cached = count_cached_tile(key, area, histogram);
+  tilemutex.unlock();
+
+  if (!cached) {
+    acquire_file(key.file);
+
+    const Layer& layer = file.layers[key.layer];
+    int tile_width = (int) layer.tiling.tile_width;
+    int tile_height = (int) layer.tiling.tile_height;
+
+    Image image{allocate_pixel_buffer(tile_width * tile_height * sizeof(Color)), tile_width, tile_height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+
+    uint64_t decoded_pixels;
+    decode_render_tile(file, key, options, (Color*) image.data, decoded_pixels);
+    release_file(file);
+
+    count_tile_area((const Color*) image.data, tile_width, area, histogram);
+    release_pixel_buffer(image);
+  }
+
+  std::lock_guard<std::mutex> lock(region_mutex);
+  if (request.generation != region.generation) {
+    return;
+  }
+
+  for (int c = 0; c < 3; c++) {
+    for (int v = 0; v < 256; v++) {
+      region.histogram.counts[c][v] += histogram.counts[c][v];
+    }
+  }
+
+  region.histogram.pixels += histogram.pixels;
+  region.tiles_done++;
+
+  queue_region_tiles();
+}
+
+void get_channel_statistics(const Histogram& histogram, int channel, double& mean, double& stddev)
+{
+  double sum = 0, sum_sq = 0;
+  for (int v = 0; v < 256; v++) {
+    sum += (double) v * (double) histogram.counts[channel][v];
+    sum_sq += (double) v * v * (double) histogram.counts[channel][v];
+  }
+
+  double n = (double) std::max((uint64_t) 1, histogram.pixels);
+  mean = sum / n;
+  stddev = std::sqrt(std::max(0.0, sum_sq / n - mean * mean));
+}
+
+void print_region_stats()
+{
+  printf("region %d,%d - %d,%d: %" PRIu64 " pixels in %zu tiles, %.1f s\n", region.x0, region.y0, region.x1, region.y1,
+         region.histogram.pixels, region.tiles.size(),
+         std::chrono::duration<double>(std::chrono::steady_clock::now() - region.start_time).count());
+
+  const char* channels[] = {"red", "green", "blue"};
+  for (int c = 0; c < 3; c++) {
+    double mean, stddev;
+    get_channel_statistics(region.histogram, c, mean, stddev);
+    printf("  %-5s  mean: %7.2f  stddev: %7.2f\n", channels[c], mean, stddev);
+  }
+}
+
+// Plans the files that have been opened meanwhile and detects the end of the count. Returns true when it has just finished.
+bool update_region_stats()
+{
+  std::vector<uint32_t> files_to_plan;
+  {
+    std::lock_guard<std::mutex> lock(region_mutex);
+    if (!region.active) {
+      return false;
+    }
+
+    files_to_plan = region.files_to_plan;
+  }
+
+  // --- open the files in the region that have not been visible yet
+
+  std::vector<uint32_t> opened_files;
+  {
+    std::lock_guard<std::mutex> lock(filemutex);
+    for (uint32_t i : files_to_plan) {
+      if (files[i].has_metadata) {
+        opened_files.push_back(i);
+      }
+      else if (!files[i].open_requested) {
+        files[i].open_requested = true;
+        request_file_open(i);
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(region_mutex);
+
+  for (uint32_t i : opened_files) {
+    auto it = std::find(region.files_to_plan.begin(), region.files_to_plan.end(), i);
+    if (it != region.files_to_plan.end()) {
+      region.files_to_plan.erase(it);
+      plan_region_file(i);
+    }
+  }
+
+  queue_region_tiles();
+
+  if (region.active && region.files_to_plan.empty() && region.tiles_done == region.tiles.size()) {
+    region.active = false;
+    region.finished = true;
+    print_region_stats();
+    return true;
+  }
+
+  return false;
+}
+
+// Draws the region with the progress or the result. 'x0,y0' is the window position on the canvas.
+void draw_region_stats(int x0, int y0)
+{
+  std::lock_guard<std::mutex> lock(region_mutex);
+
+  if (!region.active && !region.finished) {
+    return;
+  }
+
+  const View& view = views[region.view];
+  int scale = 1 << zoom_shift;
+  Rectangle area{(float) (view.x + floor_div(region.x0, scale) - x0), (float) (floor_div(region.y0, scale) - y0),
+                 (float) ((region.x1 - region.x0) / scale), (float) ((region.y1 - region.y0) / scale)};
+  DrawRectangleLinesEx(area, 2, YELLOW);
+
+  int px = view.x + 10, py = 40;
+  DrawRectangle(px, py, 300, 230, {0, 0, 0, 200});
+
+  char text[100];
+  if (region.active) {
+    snprintf(text, sizeof(text), "region: %zu / %zu tiles", region.tiles_done, region.tiles.size());
+    DrawText(text, px + 10, py + 10, 20, WHITE);
+    return;
+  }
+
+  snprintf(text, sizeof(text), "region: %" PRIu64 " pixels", region.histogram.pixels);
+  DrawText(text, px + 10, py + 10, 20, WHITE);
+
+  const char* channels[] = {"R", "G", "B"};
+  const Color colors[] = {RED, GREEN, BLUE};
+  for (int c = 0; c < 3; c++) {
+    double mean, stddev;
+    get_channel_statistics(region.histogram, c, mean, stddev);
+    snprintf(text, sizeof(text), "%s  mean %.1f  stddev %.1f", channels[c], mean, stddev);
+    DrawText(text, px + 10, py + 35 + 22 * c, 20, WHITE);
+  }
+
+  // --- histogram of the three channels, each scaled to its maximum
+
+  for (int c = 0; c < 3; c++) {
+    uint64_t max_count = *std::max_element(region.histogram.counts[c], region.histogram.counts[c] + 256);
+    for (int v = 1; v < 256; v++) {
+      int h0 = (int) (90 * (double) region.histogram.counts[c][v - 1] / (double) std::max((uint64_t) 1, max_count));
+      int h1 = (int) (90 * (double) region.histogram.counts[c][v] / (double) std::max((uint64_t) 1, max_count));
+      DrawLine(px + 22 + v - 1, py + 220 - h0, px + 22 + v, py + 220 - h1, colors[c]);
+    }
+  }
+}
+
+
+// --- Navigation: jumping to positions and bookmarks
+
+struct Location
+{
+  int x, y;        // center of the view in full resolution canvas pixels
+  uint32_t layer;  // pyramid layer, counted from the full resolution layer (0)
+};
+
+std::map<int, Location> bookmarks; // bookmarks 1-9
+std::string bookmarks_filename;
+bool prewarm_bookmarks = false;
+
+// Parses "x,y" or "x,y,layer". Without layer, the current one is kept.
+bool parse_location(const char* text, Location& location)
+{
+  location.layer = zoom_shift;
+  return sscanf(text, "%d,%d,%u", &location.x, &location.y, &location.layer) >= 2;
+}
+
+void load_bookmarks()
+{
+  std::ifstream istr(bookmarks_filename);
+
+  int slot;
+  Location location;
+  while (istr >> slot >> location.x >> location.y >> location.layer) {
+    bookmarks[slot] = location;
+  }
+}
+
+void save_bookmarks()
+{
+  if (bookmarks_filename.empty()) {
+    return;
+  }
+
+  std::ofstream ostr(bookmarks_filename);
+  for (const auto& [slot, location] : bookmarks) {
+    ostr << slot << ' ' << location.x << ' ' << location.y << ' ' << location.layer << '\n';
+  }
+}
+
+void update_max_zoom_shift()
+{
+  // The deepest pyramid of all files with known metadata limits zooming out.
+
+  std::lock_guard<std::mutex> lock(filemutex);
+  for (const auto& file : files) {
+    if (file.has_metadata) {
+      max_zoom_shift = std::max(max_zoom_shift, (uint32_t) file.layers.size() - 1);
+    }
+  }
+}
+
+// Window position at which the location is in the center of the first view
+void location_to_window(const Location& location, int& x0, int& y0)
+{
+  x0 = floor_div(location.x, 1 << location.layer) - views[0].width / 2;
+  y0 = floor_div(location.y, 1 << location.layer) - window_height / 2;
+}
+
+
+// --- Pixel inspector. Reads the pixel under the mouse from the CPU tier and never decodes on the render thread.
+
+bool show_pixel_inspector = false;
+
+// Draws the value of the pixel under the mouse. Missing tiles and pixels are requested before all other tiles
+// and shown in one of the next frames. 'tilemutex' must be held.
+void draw_pixel_inspector(int x0, int y0)
+{
+  int mouse_x = GetMouseX(), mouse_y = GetMouseY();
+  uint32_t mouse_view = (views.size() > 1 && mouse_x >= views[1].x) ? 1 : 0;
+
+  for (uint32_t i = 0; i < files.size(); i++) {
+    const HeifFile& file = files[i];
+
+    VisibleTiles visible;
+    if (file.view != mouse_view || !check_file_visibility(i, zoom_shift, x0, y0, false) || !get_visible_tiles(file, zoom_shift, x0, y0, visible)) {
+      continue;
+    }
+
+    const heif_image_tiling& tiling = file.layers[visible.layer].tiling;
+    Vector2 p = visible.placement.to_layer(Vector2{(float) mouse_x, (float) mouse_y});
+    int lx = (int) std::floor(p.x) - visible.fx0;
+    int ly = (int) std::floor(p.y) - visible.fy0;
+
+    if (lx < 0 || ly < 0 || lx >= (int) tiling.image_width || ly >= (int) tiling.image_height) {
+      continue;
+    }
+
+    int tile_width = (int) tiling.tile_width, tile_height = (int) tiling.tile_height;
+    TileKey key{i, (uint32_t) visible.layer, lx / tile_width, ly / tile_height};
+    int px = lx % tile_width, py = ly % tile_height;
+
+    set_inspected_tile(true, key);
+
+    char text[200];
+    int n = snprintf(text, sizeof(text), "layer %d  (%d,%d)  tile %d;%d  ", visible.layer, lx, ly, key.x, key.y);
+
+    Color color;
+    Tile* tile = find_tile(key);
+    if (tile && get_tile_pixel(*tile, px, py, color)) {
+      snprintf(text + n, sizeof(text) - n, "R %d  G %d  B %d  A %d", color.r, color.g, color.b, color.a);
+    }
+    else {
+      if (!tile) {
+        add_tile_to_cache(key, request_priority::visible);
+        prioritize_tile_request(key);
+      }
+      else if (tile->state == tile_state::loading) {
+        prioritize_tile_request(key);
+      }
+      else if (tile->state == tile_state::ready) {
+        request_tile_pixels(*tile);
+      }
+
+      snprintf(text + n, sizeof(text) - n, "loading...");
+    }
+
+    int tx = std::min(mouse_x + 16, window_width - MeasureText(text, 20) - 20);
+    int ty = std::min(mouse_y + 16, window_height - 40);
+    DrawRectangle(tx, ty, MeasureText(text, 20) + 20, 30, {0, 0, 0, 200});
+    DrawText(text, tx + 10, ty + 5, 20, WHITE);
+    return;
+  }
+
+  set_inspected_tile(false);
+}
+
+
+// --- Benchmark: jumps to random positions and measures the time until the tile in the center of the view
+//     and until all visible tiles are shown
+
+int benchmark_jumps = 0;
+
+// Checks whether the tile in the center of the first view is shown. Also true if there is no image in the center. 'tilemutex' must be held.
+bool center_tile_shown(int x0, int y0)
+{
+  int cx = views[0].x + views[0].width / 2;
+  int cy = window_height / 2;
+
+  for (uint32_t i = 0; i < files.size(); i++) {
+    const HeifFile& file = files[i];
+
+    VisibleTiles visible;
+    if (file.view != 0 || !check_file_visibility(i, zoom_shift, x0, y0, false) || !get_visible_tiles(file, zoom_shift, x0, y0, visible)) {
+      continue;
+    }
+
+    const heif_image_tiling& tiling = file.layers[visible.layer].tiling;
+    Vector2 center = visible.placement.to_layer(Vector2{(float) cx, (float) cy});
+    int tx = floor_div((int) center.x - visible.fx0, (int) tiling.tile_width);
+    int ty = floor_div((int) center.y - visible.fy0, (int) tiling.tile_height);
+
+    if (tx >= 0 && ty >= 0 && tx < (int) tiling.num_columns && ty < (int) tiling.num_rows) {
+      const Tile* tile = find_tile({i, (uint32_t) visible.layer, tx, ty});
+      return tile && tile->state == tile_state::ready;
+    }
+  }
+
+  return true;
+}
+
+void print_benchmark_times(const char* label, std::vector<double> ms)
+{
+  if (ms.empty()) {
+    return;
   }
 
-  Image image = {
-      .data = pixels,
-      .width = tile_width,
-      .height = tile_height,
-      .mipmaps = 1,
-      .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
-  };
+  std::sort(ms.begin(), ms.end());
 
-  tilemutex.lock();
-  for (auto& tile : tiles) {
-    if (tile.x == tx && tile.y == ty && tile.layer == layer) {
-      tile.state = tile_state::waiting_for_texture_upload;
-      tile.image = image;
-      break;
-    }
+  double total_ms = 0;
+  for (double t : ms) {
+    total_ms += t;
   }
-  tilemutex.unlock();
 
-  // clean up resources
-  heif_image_release(img);
+  size_t p95_idx = std::min(ms.size() - 1, (size_t) (ms.size() * 0.95));
+
+  printf("%s: mean %.1f ms, p95 %.1f ms, max %.1f ms\n", label, total_ms / (double) ms.size(), ms[p95_idx], ms.back());
 }
 
 
 static struct option long_options[] = {
-    {(char* const) "--no-transforms", no_argument, 0, 't'},
-    {(char* const) "help",            no_argument, 0, 'h'},
-    {0, 0,                                         0, 0}
+    {(char* const) "--no-transforms", no_argument,       0, 't'},
+    {(char* const) "mosaic",          no_argument,       0, 'm'},
+    {(char* const) "max-open-files",  required_argument, 0, 'O'},
+    {(char* const) "compare",         no_argument,       0, 'c'},
+    {(char* const) "pan-speed",       required_argument, 0, 's'},
+    {(char* const) "prefetch-lookahead", required_argument, 0, 'l'},
+    {(char* const) "goto",            required_argument, 0, 'g'},
+    {(char* const) "bookmarks",       required_argument, 0, 'b'},
+    {(char* const) "prewarm-bookmarks", no_argument,     0, 'w'},
+    {(char* const) "cache-policy",    required_argument, 0, 'p'},
+    {(char* const) "record-session",  required_argument, 0, 'r'},
+    {(char* const) "replay-session",  required_argument, 0, 'R'},
+    {(char* const) "request-order",   required_argument, 0, 'o'},
+    {(char* const) "benchmark",       required_argument, 0, 'B'},
+    {(char* const) "decode-threads",  required_argument, 0, 'j'},
+    {(char* const) "libheif-threads", required_argument, 0, 'J'},
+    {(char* const) "auto-tune-threads", no_argument,     0, 'a'},
+    {(char* const) "decoder",         required_argument, 0, 'd'},
+    {(char* const) "auto-select-decoder", no_argument,   0, 'D'},
+    {(char* const) "no-decode-state-reuse", no_argument, 0, 'N'},
+    {(char* const) "render-tile-size", required_argument, 0, 'T'},
+    {(char* const) "max-texture-size", required_argument, 0, 'X'},
+    {(char* const) "upload-budget",   required_argument, 0, 'U'},
+    {(char* const) "slice-threshold", required_argument, 0, 'S'},
+    {(char* const) "pbo-upload",      required_argument, 0, 'u'},
+    {(char* const) "gpu-orientation", no_argument,       0, 'G'},
+    {(char* const) "brightness",      required_argument, 0, 'y'},
+    {(char* const) "contrast",        required_argument, 0, 'k'},
+    {(char* const) "gamma",           required_argument, 0, 'Y'},
+    {(char* const) "swizzle",         required_argument, 0, 'W'},
+    {(char* const) "false-color",     required_argument, 0, 'F'},
+    {(char* const) "no-color-management", no_argument,   0, 'n'},
+    {(char* const) "auto-levels",     no_argument,       0, 'A'},
+    {(char* const) "region-stats",    required_argument, 0, 'e'},
+    {(char* const) "cpu-pixels",      required_argument, 0, 'K'},
+    {(char* const) "help",            no_argument,       0, 'h'},
+    {0, 0,                                               0, 0}
 };
 
 void show_help(const char* argv0)
@@ -141,9 +4015,45 @@ void show_help(const char* argv0)
   fprintf(stderr, " tiled-image-viewer      (c) Dirk Farin\n");
   fprintf(stderr, "----------------------------------------\n");
   fprintf(stderr, "usage: tiled-image-viewer [options] image.heif\n");
+  fprintf(stderr, "       tiled-image-viewer [options] --mosaic mosaic.txt\n");
+  fprintf(stderr, "       tiled-image-viewer [options] --compare image1.heif image2.heif\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "options:\n");
   fprintf(stderr, "  -t, --no-transforms  do not process HEIF image transformations\n");
+  fprintf(stderr, "  -m, --mosaic         input is a mosaic description with lines '<filename> <x> <y> [<width> <height>]'\n");
+  fprintf(stderr, "  -O, --max-open-files N  maximum number of simultaneously opened files in a mosaic (default: 64)\n");
+  fprintf(stderr, "  -c, --compare        show two images side by side with synchronized pan and zoom\n");
+  fprintf(stderr, "  -s, --pan-speed N    keyboard panning speed in pixels per second (default: 1500)\n");
+  fprintf(stderr, "  -l, --prefetch-lookahead S  prefetch tiles for the next S seconds of movement (default: 0.5, 0 = off)\n");
+  fprintf(stderr, "  -g, --goto x,y[,layer]  start centered at full resolution position (x,y), layer counted from the full resolution (0)\n");
+  fprintf(stderr, "  -b, --bookmarks FILE    load and save bookmarks in FILE\n");
+  fprintf(stderr, "  -w, --prewarm-bookmarks decode the tiles at the bookmarks in the background\n");
+  fprintf(stderr, "  -p, --cache-policy P    tile cache replacement policy: lru, arc (default: lru)\n");
+  fprintf(stderr, "  -r, --record-session FILE  record the view position of each frame into FILE\n");
+  fprintf(stderr, "  -R, --replay-session FILE  replay a recorded session and quit at its end\n");
+  fprintf(stderr, "  -o, --request-order O   order of tile requests: raster, spiral, hilbert (default: spiral)\n");
+  fprintf(stderr, "  -B, --benchmark N       jump to N random positions, print the time until the tiles are shown, and quit\n");
+  fprintf(stderr, "  -j, --decode-threads N  number of tiles decoded in parallel (default: number of cores)\n");
+  fprintf(stderr, "  -J, --libheif-threads N maximum number of threads libheif uses within one tile (default: libheif's default)\n");
+  fprintf(stderr, "  -a, --auto-tune-threads measure the decoding throughput of several thread configurations at startup and use the best one\n");
+  fprintf(stderr, "  -d, --decoder ID        use the libheif decoder plugin ID (e.g. dav1d, aom, libde265)\n");
+  fprintf(stderr, "  -D, --auto-select-decoder  measure the throughput of all decoders at startup and use the fastest one\n");
+  fprintf(stderr, "  -N, --no-decode-state-reuse  allocate decoding options and pixel buffers for each tile (for comparing allocation counts)\n");
+  fprintf(stderr, "  -T, --render-tile-size N  combine smaller file tiles into textures of about N x N pixels (default: 512, 0 = off)\n");
+  fprintf(stderr, "  -X, --max-texture-size N  split larger tiles into several textures (default: 1024)\n");
+  fprintf(stderr, "  -U, --upload-budget N     upload at most N megapixels of textures per frame (default: 4, 0 = unlimited)\n");
+  fprintf(stderr, "  -S, --slice-threshold N   decode images without tiling that are larger than N pixels once and slice them into tiles (default: 4096, 0 = off)\n");
+  fprintf(stderr, "  -G, --gpu-orientation     decode tiles without rotation and mirroring and apply them when drawing (cropping is not applied)\n");
+  fprintf(stderr, "  -u, --pbo-upload N        upload textures asynchronously through a ring of N OpenGL pixel buffer objects (default: 0 = off)\n");
+  fprintf(stderr, "  -y, --brightness F        add F to each color channel (default: 0)\n");
+  fprintf(stderr, "  -k, --contrast F          scale the contrast by F (default: 1)\n");
+  fprintf(stderr, "  -Y, --gamma F             apply gamma F (default: 1)\n");
+  fprintf(stderr, "  -W, --swizzle XYZ         show channels X,Y,Z as red, green, blue, e.g. bgr (default: rgb)\n");
+  fprintf(stderr, "  -F, --false-color LUT     show the luminance in false colors: heat, rainbow, viridis\n");
+  fprintf(stderr, "  -n, --no-color-management  show the decoded colors without converting them from the image's color profile into sRGB\n");
+  fprintf(stderr, "  -A, --auto-levels         stretch the value range of each channel to its histogram\n");
+  fprintf(stderr, "  -e, --region-stats x0,y0,x1,y1  print mean, standard deviation and histogram of a full resolution region and quit\n");
+  fprintf(stderr, "  -K, --cpu-pixels N        keep up to N megapixels of the most recently used decoded tiles for the pixel inspector (default: 32, 0 = off)\n");
   fprintf(stderr, "  -h, --help           show help\n");
 }
 
@@ -151,9 +4061,18 @@ int main(int argc, char** argv)
 {
   SetTraceLogLevel(LOG_ERROR);
 
+  bool mosaic = false;
+  bool compare = false;
+  const char* goto_location = nullptr;
+  const char* region_stats_arg = nullptr;
+  const char* record_filename = nullptr;
+  const char* replay_filename = nullptr;
+  bool auto_tune_threads = false;
+  bool auto_select_decoder = false;
+
   while (true) {
     int option_index = 0;
-    int c = getopt_long(argc, argv, "th", long_options, &option_index);
+    int c = getopt_long(argc, argv, "tmO:cs:l:g:b:wp:r:R:o:B:j:J:ad:DNT:X:U:S:u:Gy:k:Y:W:F:nAe:K:h", long_options, &option_index);
     if (c == -1)
       break;
 
@@ -161,92 +4080,322 @@ int main(int argc, char** argv)
       case 't':
         process_transformations = false;
         break;
+      case 'm':
+        mosaic = true;
+        break;
+      case 'O':
+        max_open_files = std::max(1, atoi(optarg));
+        break;
+      case 'c':
+        compare = true;
+        break;
+      case 's':
+        pan_speed = (float) atof(optarg);
+        break;
+      case 'l':
+        prefetch_lookahead = (float) atof(optarg);
+        break;
+      case 'g':
+        goto_location = optarg;
+        break;
+      case 'b':
+        bookmarks_filename = optarg;
+        break;
+      case 'w':
+        prewarm_bookmarks = true;
+        break;
+      case 'p':
+        cache_policy_name = optarg;
+        break;
+      case 'r':
+        record_filename = optarg;
+        break;
+      case 'R':
+        replay_filename = optarg;
+        break;
+      case 'o':
+        if (strcmp(optarg, "raster") == 0) {
+          tile_request_order = request_order::raster;
+        }
+        else if (strcmp(optarg, "spiral") == 0) {
+          tile_request_order = request_order::spiral;
+        }
+        else if (strcmp(optarg, "hilbert") == 0) {
+          tile_request_order = request_order::hilbert;
+        }
+        else {
+          fprintf(stderr, "Unknown request order: %s\n", optarg);
+          return 5;
+        }
+        break;
+      case 'B':
+        benchmark_jumps = std::max(1, atoi(optarg));
+        break;
+      case 'j':
+        num_decode_threads = std::max(1, atoi(optarg));
+        break;
+      case 'J':
+        libheif_decoding_threads = std::max(1, atoi(optarg));
+        break;
+      case 'a':
+        auto_tune_threads = true;
+        break;
+      case 'd':
+        decoder_id = optarg;
+        break;
+      case 'D':
+        auto_select_decoder = true;
+        break;
+      case 'N':
+        reuse_decode_state = false;
+        break;
+      case 'T':
+        render_tile_size = (uint32_t) std::max(0, atoi(optarg));
+        break;
+      case 'X':
+        max_texture_size = std::max(64, atoi(optarg));
+        break;
+      case 'U':
+        upload_budget = (int) (std::max(0.0, atof(optarg)) * 1024 * 1024);
+        break;
+      case 'S':
+        slice_threshold = (uint32_t) std::max(0, atoi(optarg));
+        break;
+      case 'u':
+        num_upload_buffers = std::max(0, atoi(optarg));
+        break;
+      case 'G':
+        gpu_orientation = true;
+        break;
+      case 'y':
+        tone.brightness = (float) atof(optarg);
+        break;
+      case 'k':
+        tone.contrast = std::max(0.0f, (float) atof(optarg));
+        break;
+      case 'Y':
+        tone.gamma = std::max(0.1f, (float) atof(optarg));
+        break;
+      case 'W':
+        if (!is_valid_swizzle(optarg)) {
+          fprintf(stderr, "Invalid channel swizzle: %s\n", optarg);
+          return 5;
+        }
+        tone.swizzle = optarg;
+        break;
+      case 'F':
+        if (!is_valid_false_color(optarg)) {
+          fprintf(stderr, "Unknown false-color LUT: %s\n", optarg);
+          return 5;
+        }
+        tone.false_color = optarg;
+        break;
+      case 'n':
+        color_management = false;
+        break;
+      case 'A':
+        auto_levels = true;
+        break;
+      case 'e':
+        region_stats_arg = optarg;
+        break;
+      case 'K':
+        cpu_pixel_budget = (size_t) (std::max(0.0, atof(optarg)) * 1024 * 1024);
+        break;
       case 'h':
         show_help(argv[0]);
         return 0;
     }
   }
 
-  if (optind != argc - 1) {
+  if (optind != argc - (compare ? 2 : 1) || (compare && mosaic)) {
     show_help(argv[0]);
     return 0;
   }
 
   const char* input_filename = argv[optind];
 
-  ctx = heif_context_alloc();
-
-  // --- remove security limit to be able to load extremely large 'grid' images
+  if (mosaic) {
+    read_mosaic(input_filename);
+  }
+  else if (compare) {
+    for (int i = 0; i < 2; i++) {
+      HeifFile file;
+      file.filename = argv[optind + i];
+      file.view = i;
+      files.push_back(file);
+    }
+  }
+  else {
+    HeifFile file;
+    file.filename = input_filename;
+    files.push_back(file);
+  }
 
-  const heif_security_limits* no_limits = heif_get_disabled_security_limits();
-  heif_context_set_security_limits(ctx, no_limits);
+  int num_views = compare ? 2 : 1;
+  for (int i = 0; i < num_views; i++) {
+    View view;
+    view.x = i * window_width / num_views;
+    view.width = (i + 1) * window_width / num_views - view.x;
+    views.push_back(view);
+  }
 
-  // --- load and parse input file
+  for (int i = 0; i < num_views; i++) {
+    cache_policies.push_back(create_cache_policy(cache_policy_name, view_cache_size()));
+    if (!cache_policies.back()) {
+      fprintf(stderr, "Unknown cache policy: %s\n", cache_policy_name.c_str());
+      return 5;
+    }
+  }
 
-  printf("loading ...\n");
+  // --- Files with unknown size have to be opened now. The others are opened when they become visible.
 
-  heif_error err = heif_context_read_from_file(ctx, input_filename, nullptr);
-  if (err.code) {
-    fprintf(stderr, "Cannot load file: %s\n", err.message);
-    exit(10);
+  for (uint32_t i = 0; i < files.size(); i++) {
+    if (files[i].width == 0) {
+      release_file(acquire_file(i));
+    }
   }
 
   printf("loading finished\n");
 
-  // --- get the ID of the primary image
-
-  heif_item_id  primary_id;
-  err = heif_context_get_primary_image_ID(ctx, &primary_id);
-  if (err.code) {
-    fprintf(stderr, "Cannot get primary image: %s\n", err.message);
-    exit(10);
+  if (files[0].has_metadata) {
+    zoom_shift = (uint32_t) files[0].layers.size() - 1 - files[0].primary_layer;
   }
 
 
-  // --- Load multi-resolution pyramid if there is one.
-
-  int nGroups;
-  struct heif_entity_group* groups = heif_context_get_entity_groups(ctx, heif_fourcc('p', 'y', 'm', 'd'), primary_id, &nGroups);
-  if (nGroups > 0) {
-    assert(nGroups == 1);
-    pymd_layer_handles.resize(groups[0].num_entities);
-
-    for (uint32_t i = 0; i < groups[0].num_entities; i++) {
-      uint32_t layer_image_id = groups[0].entities[i];
-      heif_context_get_image_handle(ctx, layer_image_id, &pymd_layer_handles[i]);
-      if (layer_image_id == primary_id) {
-        active_layer = i;
+  if (!decoder_id.empty()) {
+    auto ids = get_decoder_ids();
+    if (std::find(ids.begin(), ids.end(), decoder_id) == ids.end()) {
+      fprintf(stderr, "Unknown decoder: %s. Available decoders:", decoder_id.c_str());
+      for (const auto& id : ids) {
+        fprintf(stderr, " %s", id.c_str());
       }
+      fprintf(stderr, "\n");
+      return 5;
     }
   }
-  else {
-    // Build dummy pyramid of only one image
 
-    pymd_layer_handles.resize(1);
-    heif_context_get_image_handle(ctx, primary_id, &pymd_layer_handles[0]);
-    active_layer = 0;
+  if (auto_select_decoder) {
+    select_fastest_decoder();
+  }
+
+  if (auto_tune_threads) {
+    auto_tune_threading();
   }
-  heif_entity_groups_release(groups, nGroups);
 
+  // --- Region statistics on the command line, without opening the window
 
-  // --- Get tiling information for active layer
+  if (region_stats_arg) {
+    int rx0, ry0, rx1, ry1;
+    if (sscanf(region_stats_arg, "%d,%d,%d,%d", &rx0, &ry0, &rx1, &ry1) != 4) {
+      fprintf(stderr, "Invalid region: %s\n", region_stats_arg);
+      return 5;
+    }
+
+    start_decode_pool();
+    start_region_stats(0, rx0, ry0, rx1, ry1);
 
-  heif_image_handle_get_image_tiling(pymd_layer_handles[active_layer], process_transformations, &tiling);
-  tile_width = (int)tiling.tile_width;
-  tile_height = (int)tiling.tile_height;
+    while (!update_region_stats()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+      std::lock_guard<std::mutex> lock(region_mutex);
+      printf("%zu / %zu tiles\n", region.tiles_done, region.tiles.size());
+    }
 
-  printf("tilesize: %u x %u\n", tiling.tile_width, tiling.tile_height);
-  printf("tiles: %u x %u\n", tiling.num_columns, tiling.num_rows);
+    printf("histogram (value red green blue):\n");
+    for (int v = 0; v < 256; v++) {
+      printf("%3d %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", v,
+             region.histogram.counts[0][v], region.histogram.counts[1][v], region.histogram.counts[2][v]);
+    }
 
+    stop_decode_pool();
+    return 0;
+  }
 
   // --- Display image and interaction loop
 
+  start_decode_pool();
+
   InitWindow(window_width, window_height, "Tiled HEIF Image Viewer    (c) Dirk Farin");
+  init_upload_buffers();
+  init_tile_shader();
   int x00 = 0, y00 = 0;
   int mx = 0, my = 0;
   int dx = 0, dy = 0;
   bool mouse_pressed = false;
 
+  float pan_vx = 0, pan_vy = 0;   // current panning velocity of the window on the canvas, in pixels per second
+  float pan_fx = 0, pan_fy = 0;   // sub-pixel remainder of the panning position
+  float drag_vx = 0, drag_vy = 0; // smoothed velocity while dragging with the mouse
+  int last_mouse_x = 0, last_mouse_y = 0;
+
+  max_prefetch_requests = std::max(1, tile_cache_size / 4);
+
+  // --- Jumping to a location drops all waiting requests. The visible tiles of the new location
+  //     will be requested first, after the tiles of a coarse layer that are shown as placeholders meanwhile.
+
+  auto jump_to = [&](Location location) {
+    update_max_zoom_shift();
+    location.layer = std::min(location.layer, max_zoom_shift);
+
+    zoom_shift = location.layer;
+    location_to_window(location, x00, y00);
+    dx = dy = 0;
+    pan_vx = pan_vy = 0;
+
+    std::lock_guard<std::mutex> lock(tilemutex);
+    cancel_tile_requests();
+    request_placeholder_tiles(zoom_shift, x00, y00, 2);
+  };
+
+  if (!bookmarks_filename.empty()) {
+    load_bookmarks();
+  }
+
+  auto prewarm_bookmark = bookmarks.begin();
+
+  if (goto_location) {
+    Location location;
+    if (!parse_location(goto_location, location)) {
+      fprintf(stderr, "Invalid location: %s\n", goto_location);
+      return 5;
+    }
+
+    jump_to(location);
+  }
+
+  // --- A session is recorded as one line per frame: window position, zoom and the panning velocity used for prefetching
+
+  std::ofstream record_stream;
+  if (record_filename) {
+    record_stream.open(record_filename);
+  }
+
+  std::ifstream replay_stream;
+  if (replay_filename) {
+    replay_stream.open(replay_filename);
+    if (!replay_stream) {
+      fprintf(stderr, "Cannot open session file: %s\n", replay_filename);
+      return 5;
+    }
+  }
+
+  std::mt19937 benchmark_random(1); // same positions in each run
+  std::vector<double> benchmark_center_ms, benchmark_visible_ms;
+  int benchmark_jump = 0;
+  double benchmark_jump_time = 0;
+  bool benchmark_center_shown = false;
+  bool benchmark_next_jump = (benchmark_jumps > 0);
+
+  bool selecting_region = false; // Shift + dragging selects a region for its statistics
+  int select_x = 0, select_y = 0;
+  uint32_t select_view = 0;
+
+  bool goto_input_active = false;
+  std::string goto_input;
+  std::string status_message;
+  double status_message_time = 0;
+
   SetTargetFPS(50);
 
   while (!WindowShouldClose()) {
@@ -258,27 +4407,30 @@ int main(int argc, char** argv)
 
     float wheel = GetMouseWheelMove();  // 0, 1, -1
 
-    if (wheel > 0 && active_layer < pymd_layer_handles.size() - 1) {
-      active_layer++;
+    update_max_zoom_shift();
+
+    // zoom around the mouse position relative to the view under the mouse
 
-      heif_image_handle_get_image_tiling(pymd_layer_handles[active_layer], process_transformations, &tiling);
-      tile_width = (int)tiling.tile_width;
-      tile_height = (int)tiling.tile_height;
+    int mouse_view_x = 0;
+    for (const auto& view : views) {
+      if (GetMouseX() >= view.x) {
+        mouse_view_x = view.x;
+      }
+    }
 
-      int m_x = GetMouseX();
+    if (wheel > 0 && zoom_shift > 0) {
+      zoom_shift--;
+
+      int m_x = GetMouseX() - mouse_view_x;
       int m_y = GetMouseY();
 
       x00 = (x00 + m_x) * 2 - m_x;
       y00 = (y00 + m_y) * 2 - m_y;
     }
-    else if (wheel < 0 && active_layer > 0) {
-      active_layer--;
-
-      heif_image_handle_get_image_tiling(pymd_layer_handles[active_layer], process_transformations, &tiling);
-      tile_width = (int)tiling.tile_width;
-      tile_height = (int)tiling.tile_height;
+    else if (wheel < 0 && zoom_shift < max_zoom_shift) {
+      zoom_shift++;
 
-      int m_x = GetMouseX();
+      int m_x = GetMouseX() - mouse_view_x;
       int m_y = GetMouseY();
 
       x00 = (x00 + m_x) / 2 - m_x;
@@ -287,98 +4439,424 @@ int main(int argc, char** argv)
 
     // --- Mouse panning
 
-    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+    float dt = std::max(GetFrameTime(), 0.001f);
+
+    // --- Clicking into the minimap jumps to that position
+
+    Minimap minimap;
+    bool minimap_visible = show_minimap && get_minimap(minimap);
+
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT))) {
+      selecting_region = true;
+      select_x = GetMouseX();
+      select_y = GetMouseY();
+      select_view = (views.size() > 1 && select_x >= views[1].x) ? 1 : 0;
+    }
+
+    if (selecting_region) {
+      if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+        selecting_region = false;
+
+        // window to canvas position at full resolution
+        int view_x = views[select_view].x;
+        int scale = 1 << zoom_shift;
+        start_region_stats(select_view,
+                           (x00 + select_x - view_x) * scale, (y00 + select_y) * scale,
+                           (x00 + GetMouseX() - view_x) * scale, (y00 + GetMouseY()) * scale);
+      }
+    }
+    else if (minimap_visible && IsMouseButtonPressed(MOUSE_BUTTON_LEFT) &&
+        CheckCollisionPointRec(GetMousePosition(), minimap.area)) {
+      Location location;
+      location.x = minimap.canvas_x0 + (int) ((float) (GetMouseX() - (int) minimap.area.x) / minimap.scale);
+      location.y = minimap.canvas_y0 + (int) ((float) (GetMouseY() - (int) minimap.area.y) / minimap.scale);
+      location.layer = zoom_shift;
+      jump_to(location);
+    }
+    else if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
       mx = GetMouseX();
       my = GetMouseY();
       dx = dy = 0;
+      drag_vx = drag_vy = 0;
+      pan_vx = pan_vy = 0;
       mouse_pressed = true;
     }
-    else if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+    else if (mouse_pressed && IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
       x00 -= dx;
       y00 -= dy;
       dx = dy = 0;
       mouse_pressed = false;
+
+      // continue moving with the velocity of the drag
+      pan_vx = drag_vx;
+      pan_vy = drag_vy;
     }
     else if (mouse_pressed) {
       dx = GetMouseX() - mx;
       dy = GetMouseY() - my;
+
+      drag_vx = 0.5f * drag_vx - 0.5f * (float) (GetMouseX() - last_mouse_x) / dt;
+      drag_vy = 0.5f * drag_vy - 0.5f * (float) (GetMouseY() - last_mouse_y) / dt;
+    }
+
+    last_mouse_x = GetMouseX();
+    last_mouse_y = GetMouseY();
+
+    // --- Keyboard panning with constant pixel velocity. Without key pressed, kinetic scrolling slows down.
+
+    int key_x = (int) IsKeyDown(KEY_RIGHT) - (int) IsKeyDown(KEY_LEFT);
+    int key_y = (int) IsKeyDown(KEY_DOWN) - (int) IsKeyDown(KEY_UP);
+
+    if (key_x || key_y) {
+      float norm = std::sqrt((float) (key_x * key_x + key_y * key_y));
+      pan_vx = pan_speed * (float) key_x / norm;
+      pan_vy = pan_speed * (float) key_y / norm;
+    }
+    else {
+      float decay = std::exp(-kinetic_friction * dt);
+      pan_vx *= decay;
+      pan_vy *= decay;
+
+      if (std::hypot(pan_vx, pan_vy) < 20) {
+        pan_vx = pan_vy = 0;
+      }
+    }
+
+    if (!mouse_pressed) {
+      pan_fx += pan_vx * dt;
+      pan_fy += pan_vy * dt;
+
+      int step_x = (int) pan_fx;
+      int step_y = (int) pan_fy;
+      x00 += step_x;
+      y00 += step_y;
+      pan_fx -= (float) step_x;
+      pan_fy -= (float) step_y;
     }
 
     int x0 = x00 - dx;
     int y0 = y00 - dy;
 
-    int tile_idx_x0 = x0 / tile_width;
-    int tile_idx_y0 = y0 / tile_height;
+    // --- Text input of a location to jump to
 
-    // --- Draw all tiles visible on screen
+    if (goto_input_active) {
+      for (int c = GetCharPressed(); c > 0; c = GetCharPressed()) {
+        if ((c >= '0' && c <= '9') || c == ',' || c == '-') {
+          goto_input += (char) c;
+        }
+      }
 
-    tilemutex.lock();
+      if (IsKeyPressed(KEY_BACKSPACE) && !goto_input.empty()) {
+        goto_input.pop_back();
+      }
 
-    for (int ty = tile_idx_y0; ty * tile_height - y0 < window_height; ty++) {
-      for (int tx = tile_idx_x0; tx * tile_width - x0 < window_width; tx++) {
+      if (IsKeyPressed(KEY_ENTER)) {
+        Location location;
+        if (parse_location(goto_input.c_str(), location)) {
+          jump_to(location);
+        }
 
-        if (tx < 0 || tx >= tiling.num_columns)
-          continue;
+        goto_input_active = false;
+      }
+    }
+    else {
+      if (IsKeyPressed(KEY_G)) {
+        goto_input_active = true;
+        goto_input.clear();
+        while (GetCharPressed() > 0) {
+          // skip the 'g'
+        }
+      }
+
+      if (IsKeyPressed(KEY_P)) {
+        tilemutex.lock();
+        print_decode_profile();
+        print_cache_statistics();
+        tilemutex.unlock();
+      }
+
+      if (IsKeyPressed(KEY_H)) {
+        heatmap = (heatmap == heatmap_mode::off) ? heatmap_mode::accesses :
+                  (heatmap == heatmap_mode::accesses) ? heatmap_mode::decode_latency : heatmap_mode::off;
+      }
 
-        if (ty < 0 || ty >= tiling.num_rows)
+      if (IsKeyPressed(KEY_C)) {
+        write_heatmaps();
+      }
+
+      if (IsKeyPressed(KEY_M)) {
+        show_minimap = !show_minimap;
+      }
+
+      if (IsKeyPressed(KEY_I)) {
+        show_pixel_inspector = !show_pixel_inspector;
+      }
+
+      // --- Tone adjustments. Only the shader parameters change, the tiles are neither decoded nor uploaded again.
+
+      bool tone_changed = true;
+      if (IsKeyPressed(KEY_LEFT_BRACKET)) {
+        tone.brightness -= 0.05f;
+      }
+      else if (IsKeyPressed(KEY_RIGHT_BRACKET)) {
+        tone.brightness += 0.05f;
+      }
+      else if (IsKeyPressed(KEY_COMMA)) {
+        tone.contrast = std::max(0.0f, tone.contrast - 0.1f);
+      }
+      else if (IsKeyPressed(KEY_PERIOD)) {
+        tone.contrast += 0.1f;
+      }
+      else if (IsKeyPressed(KEY_MINUS)) {
+        tone.gamma = std::max(0.1f, tone.gamma - 0.1f);
+      }
+      else if (IsKeyPressed(KEY_EQUAL)) {
+        tone.gamma += 0.1f;
+      }
+      else if (IsKeyPressed(KEY_S)) {
+        auto it = std::find(std::begin(swizzles), std::end(swizzles), tone.swizzle);
+        tone.swizzle = (it == std::end(swizzles) || it + 1 == std::end(swizzles)) ? swizzles[0] : *(it + 1);
+      }
+      else if (IsKeyPressed(KEY_F)) {
+        auto it = std::find(std::begin(false_color_luts), std::end(false_color_luts), tone.false_color);
+        tone.false_color = (it == std::end(false_color_luts)) ? false_color_luts[0] : (it + 1 == std::end(false_color_luts)) ? "" : *(it + 1);
+      }
+      else if (IsKeyPressed(KEY_A)) {
+        auto_levels = !auto_levels;
+      }
+      else if (IsKeyPressed(KEY_R)) {
+        tone = ToneAdjustment();
+        auto_levels = false;
+      }
+      else {
+        tone_changed = false;
+      }
+
+      if (tone_changed) {
+        status_message = tone_description();
+        status_message_time = GetTime();
+      }
+
+      // --- Bookmarks: Ctrl+1..9 stores the current location, 1..9 jumps to it
+
+      for (int slot = 1; slot <= 9; slot++) {
+        if (!IsKeyPressed(KEY_ZERO + slot)) {
           continue;
+        }
 
-        bool tile_found = false;
-
-        for (size_t i = 0; i < tiles.size(); i++) {
-          if (tiles[i].x == tx && tiles[i].y == ty && tiles[i].layer == active_layer) {
-            tile_found = true;
-            if (tiles[i].state == tile_state::ready) {
-              DrawTexture(tiles[i].texture, tx * tile_width - x0, ty * tile_height - y0, WHITE);
-              move_tile_to_front_of_lru_cache(i);
-            }
-            else if (tiles[i].state == tile_state::waiting_for_texture_upload) {
-              tiles[i].texture = LoadTextureFromImage(tiles[i].image);
-              UnloadImage(tiles[i].image);
-              tiles[i].state = tile_state::ready;
-              DrawTexture(tiles[i].texture, tx * tile_width - x0, ty * tile_height - y0, WHITE);
-              move_tile_to_front_of_lru_cache(i);
-            }
-          }
+        if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+          Location location;
+          location.layer = zoom_shift;
+          location.x = (x0 + views[0].width / 2) * (1 << zoom_shift);
+          location.y = (y0 + window_height / 2) * (1 << zoom_shift);
+          bookmarks[slot] = location;
+          save_bookmarks();
 
-          DrawRectangleLines(tx * tile_width - x0, ty * tile_height - y0, tile_width, tile_height, WHITE);
+          status_message = "bookmark " + std::to_string(slot) + " stored";
         }
+        else if (bookmarks.count(slot)) {
+          jump_to(bookmarks[slot]);
+          status_message = "bookmark " + std::to_string(slot);
+        }
+        else {
+          status_message = "no bookmark " + std::to_string(slot);
+        }
+
+        status_message_time = GetTime();
+      }
+    }
 
-        // --- If the tile is not loaded yet, load it in the background
+    // --- Benchmark: jump to the next random position at the current zoom level when all tiles are shown
 
-        if (!tile_found) {
-          if (tiles.size() == tile_cache_size) {
-            if (tiles.back().state == tile_state::ready) {
-              UnloadTexture(tiles.back().texture);
-            }
-            if (tiles.back().state == tile_state::waiting_for_texture_upload) {
-              UnloadImage(tiles.back().image);
-            }
+    if (benchmark_next_jump) {
+      if (benchmark_jump == benchmark_jumps) {
+        EndDrawing();
+        break;
+      }
 
-            tiles.pop_back();
-          }
+      const HeifFile& file = files[benchmark_random() % files.size()];
 
-          Tile t;
-          t.x = tx;
-          t.y = ty;
-          t.layer = active_layer;
-          tiles.push_back(t);
-          move_tile_to_front_of_lru_cache(tiles.size() - 1);
+      Location location;
+      location.x = file.offset_x + (int) (benchmark_random() % std::max(1U, file.width));
+      location.y = file.offset_y + (int) (benchmark_random() % std::max(1U, file.height));
+      location.layer = zoom_shift;
+      jump_to(location);
 
-          // load Tile
-          std::thread loadingThread(load_tile, tx, ty, active_layer);
-          loadingThread.detach();
+      benchmark_jump++;
+      benchmark_jump_time = GetTime();
+      benchmark_center_shown = false;
+      benchmark_next_jump = false;
+    }
+
+    x0 = x00 - dx;
+    y0 = y00 - dy;
+
+    float vx = mouse_pressed ? drag_vx : pan_vx;
+    float vy = mouse_pressed ? drag_vy : pan_vy;
+
+    if (replay_filename) {
+      if (!(replay_stream >> x00 >> y00 >> zoom_shift >> vx >> vy)) {
+        EndDrawing();
+        break;
+      }
+
+      x0 = x00;
+      y0 = y00;
+      dx = dy = 0;
+    }
+
+    if (record_filename) {
+      record_stream << x0 << ' ' << y0 << ' ' << zoom_shift << ' ' << vx << ' ' << vy << '\n';
+    }
+
+    frame_nr++;
+
+    // --- Draw all tiles visible on screen. Files outside of the window are skipped.
+
+    map_upload_buffers();
+
+    tilemutex.lock();
+
+    visible_tiles_pending = 0;
+    frame_upload_pixels = 0;
+
+    for (uint32_t v = 0; v < views.size(); v++) {
+      BeginScissorMode(views[v].x, 0, views[v].width, window_height);
+
+      for (uint32_t i = 0; i < files.size(); i++) {
+        if (files[i].view == v) {
+          draw_file(i, x0, y0);
         }
       }
+
+      EndScissorMode();
+    }
+
+    // --- Prefetch the tiles in the direction of movement
+
+    if ((vx != 0 || vy != 0) && prefetch_lookahead > 0) {
+      const int steps = 2;
+      for (int step = 1; step <= steps; step++) {
+        float t = prefetch_lookahead * (float) step / steps;
+
+        request_tiles(zoom_shift, x0 + (int) (vx * t), y0 + (int) (vy * t), request_priority::prefetch);
+      }
+    }
+
+    if (minimap_visible) {
+      request_minimap_tiles();
+      draw_minimap(minimap, x0, y0);
+    }
+
+    if (auto_levels) {
+      count_histograms = true;
+      request_histogram_tiles();
+    }
+
+    update_region_stats();
+    draw_region_stats(x0, y0);
+
+    if (selecting_region) {
+      DrawRectangleLines(std::min(select_x, GetMouseX()), std::min(select_y, GetMouseY()),
+                         std::abs(GetMouseX() - select_x), std::abs(GetMouseY() - select_y), YELLOW);
+    }
+
+    if (show_pixel_inspector) {
+      draw_pixel_inspector(x0, y0);
+    }
+    else {
+      set_inspected_tile(false);
+    }
+
+    // --- Decode the tiles at the bookmarks in the background, one bookmark at a time while the decoder is idle
+
+    if (prewarm_bookmarks && prewarm_bookmark != bookmarks.end() && decode_queues_empty()) {
+      int bx0, by0;
+      location_to_window(prewarm_bookmark->second, bx0, by0);
+      request_tiles(std::min(prewarm_bookmark->second.layer, max_zoom_shift), bx0, by0, request_priority::prefetch, true);
+
+      ++prewarm_bookmark;
+    }
+
+    if (benchmark_jumps > 0 && !benchmark_next_jump) {
+      double ms = (GetTime() - benchmark_jump_time) * 1000;
+
+      if (!benchmark_center_shown && center_tile_shown(x0, y0)) {
+        benchmark_center_shown = true;
+        benchmark_center_ms.push_back(ms);
+      }
+
+      if (benchmark_center_shown && visible_tiles_pending == 0) {
+        benchmark_visible_ms.push_back(ms);
+        benchmark_next_jump = true;
+      }
+    }
+
+    if (compare) {
+      for (uint32_t v = 0; v < views.size(); v++) {
+        draw_view_statistics(views[v], files[v].filename.c_str());
+      }
+
+      DrawLine(views[1].x, 0, views[1].x, window_height, WHITE);
     }
+
     tilemutex.unlock();
 
+    if (goto_input_active) {
+      std::string text = "go to x,y[,layer]: " + goto_input + "_";
+      DrawRectangle(0, window_height - 40, MeasureText(text.c_str(), 20) + 20, 40, {0, 0, 0, 200});
+      DrawText(text.c_str(), 10, window_height - 30, 20, WHITE);
+    }
+    else if (!status_message.empty() && GetTime() - status_message_time < 2) {
+      DrawRectangle(0, window_height - 40, MeasureText(status_message.c_str(), 20) + 20, 40, {0, 0, 0, 200});
+      DrawText(status_message.c_str(), 10, window_height - 30, 20, WHITE);
+    }
+
     EndDrawing();
   }
 
+  stop_decode_pool();
+
+  free_upload_buffers();
+  free_tile_shader();
   CloseWindow();
 
-  heif_context_free(ctx);
+  print_decode_profile();
+  print_cache_statistics();
+
+  filemutex.lock();
+  for (auto& file : files) {
+    if (file.ctx) {
+      close_file(file);
+    }
+    if (file.scratch) {
+      free_scratch_image(file.scratch);
+      file.scratch = nullptr;
+    }
+  }
+  filemutex.unlock();
+
+  if (compare) {
+    for (uint32_t v = 0; v < views.size(); v++) {
+      const View& view = views[v];
+      printf("%s: %d tiles decoded, mean %.1f ms/tile\n", files[v].filename.c_str(),
+             view.tiles_decoded, view.tiles_decoded ? view.total_decode_ms / view.tiles_decoded : 0.0);
+    }
+  }
+
+  if (benchmark_jumps > 0) {
+    const char* order_names[] = {"raster", "spiral", "hilbert"};
+    printf("benchmark: %zu jumps, request order %s, %d decoding threads, %d libheif threads, decoder %s\n", benchmark_visible_ms.size(),
+           order_names[(int) tile_request_order], num_decode_threads, libheif_decoding_threads,
+           decoder_id.empty() ? "(default)" : decoder_id.c_str());
+    print_benchmark_times("  time to center tile", benchmark_center_ms);
+    print_benchmark_times("  time to all visible tiles", benchmark_visible_ms);
+  }
+
+  const auto& stats = context_pool_stats;
+  printf("context pool: %d opens (mean %.1f ms, max %.1f ms), %d closes, max. %d files open\n",
+         stats.opens, stats.opens ? stats.total_open_ms / stats.opens : 0.0, stats.max_open_ms,
+         stats.closes, stats.max_open);
 
   return 0;
 }